@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+// A bounded lock-free queue safe for multiple producers and consumers,
+// following Dmitry Vyukov's bounded MPMC queue. Neither side ever blocks:
+// pushing to a full queue or popping from an empty one just fails.
+// Elements are filled and consumed in place through callbacks, so large
+// elements aren't copied through the queue.
+template<typename T>
+struct BoundedQueue {
+	// The capacity must be a power of two
+	BoundedQueue(size_t capacity)
+		: cells(new Cell[capacity]), mask(capacity - 1), enqueue_pos(0), dequeue_pos(0)
+	{
+		if (capacity < 2 || (capacity & mask) != 0) {
+			throw std::runtime_error("BoundedQueue capacity must be a power of two");
+		}
+		for (size_t i = 0; i < capacity; ++i) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	// Claim a free element and fill it by calling fill(T&), returns false
+	// if the queue is full
+	template<typename F>
+	bool push(F fill) {
+		Cell *cell = nullptr;
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		while (true) {
+			cell = &cells[pos & mask];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (diff == 0) {
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+		fill(cell->value);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+	// Take the oldest element and pass it to consume(T&) before releasing
+	// it back to the producers, returns false if the queue is empty
+	template<typename F>
+	bool pop(F consume) {
+		Cell *cell = nullptr;
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		while (true) {
+			cell = &cells[pos & mask];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+			if (diff == 0) {
+				if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+		consume(cell->value);
+		cell->sequence.store(pos + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	const size_t mask;
+	// Keep the producer and consumer positions on separate cache lines
+	char pad0[64];
+	std::atomic<size_t> enqueue_pos;
+	char pad1[64];
+	std::atomic<size_t> dequeue_pos;
+};
+
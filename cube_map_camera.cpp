@@ -0,0 +1,39 @@
+#include "camera/Camera.h"
+#include "cube_map_camera_ispc.h"
+
+namespace ospray {
+
+	// The cubemap camera, see cube_map_camera.ispc. Takes the same pos, dir
+	// and up parameters as the panoramic camera and renders an image six
+	// times as wide as it is tall, one square face after another. Setting
+	// equiAngular renders an equi-angular cube map instead.
+	struct CubeMapCamera : public Camera {
+		CubeMapCamera() {
+			ispcEquivalent = ispc::CubeMapCamera_create(this);
+		}
+		std::string toString() const override {
+			return "ospray::CubeMapCamera";
+		}
+		void commit() override {
+			Camera::commit();
+			// Orient the cube map the same way the panoramic camera orients
+			// its sphere, so both modes see the same view from the headset
+			const vec3f w = normalize(dir);
+			const vec3f u = normalize(cross(w, up));
+			const vec3f v = cross(u, w);
+			const vec3f du = u * -1.f;
+			const vec3f dv = v * -1.f;
+			const vec3f dw = w * -1.f;
+			ispc::CubeMapCamera_set(getIE(),
+					(const ispc::vec3f&)pos,
+					(const ispc::vec3f&)du,
+					(const ispc::vec3f&)dv,
+					(const ispc::vec3f&)dw,
+					getParam1i("equiAngular", 0));
+		}
+	};
+
+	OSP_REGISTER_CAMERA(CubeMapCamera, cubemap);
+
+}
+
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <array>
+#include "cube_map_converter.h"
+
+CubeMapConverter::CubeMapConverter(GLuint program)
+	: program(program), face_unif(glGetUniformLocation(program, "face")),
+	cube_map(0), fbo(0), vao(0), face_size(0)
+{
+	glGenFramebuffers(1, &fbo);
+	glGenVertexArrays(1, &vao);
+}
+CubeMapConverter::~CubeMapConverter() {
+	glDeleteProgram(program);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteVertexArrays(1, &vao);
+	if (cube_map) {
+		glDeleteTextures(1, &cube_map);
+	}
+}
+void CubeMapConverter::convert(const PanoramaTexture &panorama) {
+	GLint active_unit = 0;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &active_unit);
+	const int size = std::max(panorama.width / 4, 1);
+	if (size != face_size) {
+		if (cube_map) {
+			glDeleteTextures(1, &cube_map);
+		}
+		face_size = size;
+		glGenTextures(1, &cube_map);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, cube_map);
+		if (glTexStorage2D) {
+			glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, GL_RGBA8, face_size, face_size);
+		} else {
+			for (GLenum f = 0; f < 6; ++f) {
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_RGBA8, face_size, face_size, 0,
+						GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+			}
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_2D, panorama.texture);
+
+	// This runs only when a new panorama arrives, so querying the state to
+	// restore is cheap compared to threading it through from the caller
+	GLint prev_program = 0, prev_vao = 0, prev_fbo = 0;
+	std::array<GLint, 4> prev_viewport;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &prev_program);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prev_vao);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prev_fbo);
+	glGetIntegerv(GL_VIEWPORT, prev_viewport.data());
+	const GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "equirect"), active_unit - GL_TEXTURE0);
+	glBindVertexArray(vao);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, face_size, face_size);
+	glDisable(GL_DEPTH_TEST);
+	for (GLenum f = 0; f < 6; ++f) {
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, cube_map, 0);
+		glUniform1i(face_unif, f);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+
+	glUseProgram(prev_program);
+	glBindVertexArray(prev_vao);
+	glBindFramebuffer(GL_FRAMEBUFFER, prev_fbo);
+	glViewport(prev_viewport[0], prev_viewport[1], prev_viewport[2], prev_viewport[3]);
+	if (depth_test) {
+		glEnable(GL_DEPTH_TEST);
+	}
+}
+
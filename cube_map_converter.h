@@ -0,0 +1,33 @@
+#pragma once
+
+#include <GL/gl3w.h>
+#include "panorama_texture.h"
+
+// Converts the equirectangular panorama into a cube map on the GPU after
+// each upload, so the eyes can be drawn with a single hardware cube map
+// fetch per pixel instead of the equirect lookup's trig. Each face is
+// rendered with a fullscreen triangle, see vsrc_fullscreen and
+// fsrc_equirect_to_cube in main.cpp for the shaders.
+struct CubeMapConverter {
+	// The program renders a face of the cube map given by its "face"
+	// uniform, sampling the panorama from its "equirect" sampler. The
+	// converter takes ownership of the program
+	CubeMapConverter(GLuint program);
+	~CubeMapConverter();
+	CubeMapConverter(const CubeMapConverter&) = delete;
+	CubeMapConverter& operator=(const CubeMapConverter&) = delete;
+	// Render the panorama into the cube map, whose faces are a quarter
+	// of its width to keep its resolution at the horizon. The panorama's
+	// texture is bound to the active texture unit, and the GL state
+	// changed by the conversion is restored afterwards
+	void convert(const PanoramaTexture &panorama);
+
+	GLuint program;
+	GLint face_unif;
+	GLuint cube_map;
+	GLuint fbo;
+	// Empty VAO for drawing the fullscreen triangle
+	GLuint vao;
+	int face_size;
+};
+
@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <cstring>
+#include "dirty_tiles.h"
+
+DirtyTiles::DirtyTiles(int width, int height, int tile_size)
+	: width(width), height(height), tile_size(tile_size),
+	tiles_x((width + tile_size - 1) / tile_size),
+	tiles_y((height + tile_size - 1) / tile_size),
+	previous(size_t(width) * height, 0), has_previous(false)
+{}
+void DirtyTiles::update(const uint32_t *pixels, std::vector<uint8_t> &mask) {
+	if (mask.size() != size_t(tiles_x) * tiles_y) {
+		mask.assign(size_t(tiles_x) * tiles_y, 0);
+	}
+	if (!has_previous) {
+		std::memcpy(previous.data(), pixels, previous.size() * sizeof(uint32_t));
+		std::fill(mask.begin(), mask.end(), 1);
+		has_previous = true;
+		return;
+	}
+
+	for (int ty = 0; ty < tiles_y; ++ty) {
+		const int y_begin = ty * tile_size;
+		const int y_end = std::min(y_begin + tile_size, height);
+		for (int tx = 0; tx < tiles_x; ++tx) {
+			const int x_begin = tx * tile_size;
+			const size_t row_bytes = std::min(tile_size, width - x_begin) * sizeof(uint32_t);
+			// memcmp is vectorized and bails out at the first difference,
+			// so converged tiles cost one pass over their rows
+			int y = y_begin;
+			for (; y < y_end; ++y) {
+				const size_t offset = size_t(y) * width + x_begin;
+				if (std::memcmp(&previous[offset], &pixels[offset], row_bytes) != 0) {
+					break;
+				}
+			}
+			if (y == y_end) {
+				continue;
+			}
+			mask[ty * tiles_x + tx] = 1;
+			for (; y < y_end; ++y) {
+				const size_t offset = size_t(y) * width + x_begin;
+				std::memcpy(&previous[offset], &pixels[offset], row_bytes);
+			}
+		}
+	}
+}
+void DirtyTiles::dirty_rects(const std::vector<uint8_t> &mask, std::vector<TileRect> &rects) const {
+	rects.clear();
+	for (int ty = 0; ty < tiles_y; ++ty) {
+		const int y = ty * tile_size;
+		const int h = std::min(tile_size, height - y);
+		int tx = 0;
+		while (tx < tiles_x) {
+			if (!mask[ty * tiles_x + tx]) {
+				++tx;
+				continue;
+			}
+			const int run_begin = tx;
+			while (tx < tiles_x && mask[ty * tiles_x + tx]) {
+				++tx;
+			}
+			const int x = run_begin * tile_size;
+			rects.push_back(TileRect{x, y, std::min(tx * tile_size, width) - x, h});
+		}
+	}
+}
+
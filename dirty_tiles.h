@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// A rectangle of the panorama, in pixels
+struct TileRect {
+	int x, y, width, height;
+};
+
+// Tracks which tiles of the panorama change from frame to frame by comparing
+// each frame against a copy of the previous one. Once progressive
+// accumulation converges most tiles stop changing and don't need to be
+// uploaded again.
+struct DirtyTiles {
+	DirtyTiles(int width, int height, int tile_size = 64);
+	// Compare the frame against the previous one, setting the flag of
+	// each tile that changed in the mask and updating the stored copy.
+	// Flags for tiles which didn't change are left as is, so the mask can
+	// accumulate changes over multiple frames.
+	void update(const uint32_t *pixels, std::vector<uint8_t> &mask);
+	// Convert a tile mask into rectangles, merging runs of dirty tiles
+	// along each row of tiles
+	void dirty_rects(const std::vector<uint8_t> &mask, std::vector<TileRect> &rects) const;
+
+	int width, height, tile_size;
+	int tiles_x, tiles_y;
+	std::vector<uint32_t> previous;
+	bool has_previous;
+};
+
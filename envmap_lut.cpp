@@ -0,0 +1,58 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "envmap_lut.h"
+
+GLuint create_equirect_uv_lut(int face_size) {
+	const float PI = 3.14159265358979f;
+	const auto to_unorm = [](float x) {
+		return static_cast<uint16_t>(std::min(std::max(x, 0.f), 1.f) * 65535.f + 0.5f);
+	};
+
+	GLuint lut;
+	glGenTextures(1, &lut);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, lut);
+	std::vector<uint16_t> texels(size_t(face_size) * face_size * 3);
+	for (int f = 0; f < 6; ++f) {
+		for (int j = 0; j < face_size; ++j) {
+			for (int i = 0; i < face_size; ++i) {
+				// Direction through the texel center, following the GL spec's
+				// cube map table like the cubemap camera
+				const float sc = 2.f * (i + 0.5f) / face_size - 1.f;
+				const float tc = 2.f * (j + 0.5f) / face_size - 1.f;
+				float x, y, z;
+				switch (f) {
+					case 0: x = 1.f; y = -tc; z = -sc; break;
+					case 1: x = -1.f; y = -tc; z = sc; break;
+					case 2: x = sc; y = 1.f; z = tc; break;
+					case 3: x = sc; y = -1.f; z = -tc; break;
+					case 4: x = sc; y = -tc; z = 1.f; break;
+					default: x = -sc; y = -tc; z = -1.f; break;
+				}
+				const float len = std::sqrt(x * x + y * y + z * z);
+
+				// The same mapping as the exact equirect display shader
+				float u = (std::atan2(z, x) + PI / 2.f) / (2.f * PI);
+				u -= std::floor(u);
+				const float shifted = u + 0.5f - std::floor(u + 0.5f);
+				const float v = std::acos(y / len) / PI;
+
+				uint16_t *t = &texels[(size_t(j) * face_size + i) * 3];
+				t[0] = to_unorm(u);
+				t[1] = to_unorm(shifted);
+				t[2] = to_unorm(v);
+			}
+		}
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_RGB16, face_size, face_size, 0,
+				GL_RGB, GL_UNSIGNED_SHORT, texels.data());
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	return lut;
+}
+
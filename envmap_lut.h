@@ -0,0 +1,14 @@
+#pragma once
+
+#include <GL/gl3w.h>
+
+// Create a cube map holding the equirectangular panorama's texture
+// coordinates for each direction, so the display shader can look them up
+// instead of computing atan and acos per fragment. Each texel stores
+// (u, u shifted by half a turn, v) as 16 bit unorms. u jumps from 1 back
+// to 0 at the panorama's seam in the -Z half of the cube, where filtering
+// it would give the wrong coordinate, so there the shader uses the shifted
+// copy, whose own seam is in the +Z half. The texture is left bound to the
+// active texture unit.
+GLuint create_equirect_uv_lut(int face_size);
+
@@ -0,0 +1,52 @@
+#include <cmath>
+#include "camera/Camera.h"
+#include "foveated_camera_ispc.h"
+
+namespace ospray {
+
+	// The foveated camera, see foveated_camera.ispc. Takes the same pos, dir
+	// and up parameters as the panoramic camera, plus the gazeDir to center
+	// the image on and the foveation strength. gazeDir is given in the
+	// display's frame, where the panorama's forward is -Z and up is +Y, so it
+	// can be taken straight from the HMD pose.
+	struct FoveatedCamera : public Camera {
+		FoveatedCamera() {
+			ispcEquivalent = ispc::FoveatedCamera_create(this);
+		}
+		std::string toString() const override {
+			return "ospray::FoveatedCamera";
+		}
+		void commit() override {
+			Camera::commit();
+			// World space directions of the display frame's axes, oriented the
+			// same way as the cubemap and panoramic cameras
+			const vec3f w = normalize(dir);
+			const vec3f u = normalize(cross(w, up));
+			const vec3f v = cross(u, w);
+			const vec3f du = u * -1.f;
+			const vec3f dv = v * -1.f;
+			const vec3f dw = w * -1.f;
+
+			// Gaze frame in the display's frame, this must match the frame the
+			// foveated panorama shader builds to undo the warp
+			const vec3f gz = normalize(getParam3f("gazeDir", vec3f(0.f, 0.f, -1.f)));
+			vec3f gy = vec3f(0.f, 1.f, 0.f) - gz * gz.y;
+			gy = std::abs(gz.y) < 0.999f ? normalize(gy) : vec3f(0.f, 0.f, gz.y > 0 ? 1.f : -1.f);
+			const vec3f gx = cross(gy, gz);
+
+			const vec3f world_gx = du * gx.x + dv * gx.y + dw * gx.z;
+			const vec3f world_gy = du * gy.x + dv * gy.y + dw * gy.z;
+			const vec3f world_gz = du * gz.x + dv * gz.y + dw * gz.z;
+			ispc::FoveatedCamera_set(getIE(),
+					(const ispc::vec3f&)pos,
+					(const ispc::vec3f&)world_gx,
+					(const ispc::vec3f&)world_gy,
+					(const ispc::vec3f&)world_gz,
+					getParam1f("foveation", 2.18f));
+		}
+	};
+
+	OSP_REGISTER_CAMERA(FoveatedCamera, foveated);
+
+}
+
@@ -0,0 +1,33 @@
+#include <algorithm>
+#include <thread>
+#include "frame_pacer.h"
+
+FramePacer::FramePacer(float vsync_period_ms, float lead_ms, float margin_ms)
+	: vsync_period_ms(vsync_period_ms), lead_ms(std::min(lead_ms, vsync_period_ms)),
+	margin_ms(margin_ms), started(false)
+{}
+void FramePacer::wait_for_start() {
+	if (!started) {
+		return;
+	}
+	using namespace std::chrono;
+	// If the last frame ran long we're already late, so start right away
+	std::this_thread::sleep_until(last_poses + duration_cast<steady_clock::duration>(
+				duration<float, std::milli>(vsync_period_ms - lead_ms)));
+}
+void FramePacer::poses_ready(float wait_ms, bool dropped) {
+	last_poses = std::chrono::steady_clock::now();
+	if (!started) {
+		started = true;
+		return;
+	}
+	if (dropped) {
+		// Back off quickly, a dropped frame costs a whole vsync
+		lead_ms += 2.f;
+	} else {
+		// Move the start toward the margin slowly, so one quick frame
+		// doesn't make us miss the next
+		lead_ms -= 0.1f * (wait_ms - margin_ms);
+	}
+	lead_ms = std::max(0.f, std::min(lead_ms, vsync_period_ms));
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <chrono>
+
+// Paces the render loop off the compositor's clock with a running start.
+// The loop sleeps until lead_ms before the compositor is expected to hand
+// out the next poses, a vsync period after it last did, polls events and
+// uploads the panorama, then only waits briefly for the poses. The lead
+// is tuned each frame from the time spent waiting, moving toward the
+// margin and growing quickly when a frame is dropped, so the CPU work
+// starts as late as it can without missing vsync.
+struct FramePacer {
+	// Start lead_ms before the poses are ready, aiming to wait margin_ms
+	FramePacer(float vsync_period_ms, float lead_ms, float margin_ms = 1.f);
+	// Sleep until the lead before the next poses are expected
+	void wait_for_start();
+	// Call once the poses are ready, with the time spent waiting for them
+	// and whether the compositor dropped the last frame
+	void poses_ready(float wait_ms, bool dropped);
+
+	float vsync_period_ms, lead_ms, margin_ms;
+	std::chrono::steady_clock::time_point last_poses;
+	bool started;
+};
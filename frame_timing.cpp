@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <fstream>
+#include "frame_timing.h"
+
+FrameTiming::FrameTiming()
+	: frame_index(0), system_time(0.0), gpu_ms(0.f), compositor_gpu_ms(0.f), cpu_wait_ms(0.f),
+	frame_interval_ms(0.f), presents(0), mispresented(0), dropped(0), reprojection_flags(0)
+{}
+
+FrameTimingSummary::FrameTimingSummary(const std::vector<FrameTiming> &timings)
+	: frames(timings.size()), dropped(0), mispresented(0), reprojected(0), average_gpu_ms(0.f),
+	max_gpu_ms(0.f), average_cpu_wait_ms(0.f)
+{
+	for (const auto &t : timings) {
+		dropped += t.dropped;
+		mispresented += t.mispresented;
+		reprojected += t.reprojection_flags != 0 ? 1 : 0;
+		average_gpu_ms += t.gpu_ms;
+		max_gpu_ms = std::max(max_gpu_ms, t.gpu_ms);
+		average_cpu_wait_ms += t.cpu_wait_ms;
+	}
+	if (frames > 0) {
+		average_gpu_ms /= frames;
+		average_cpu_wait_ms /= frames;
+	}
+}
+
+void write_frame_timings(const std::string &path, const std::vector<FrameTiming> &timings) {
+	std::ofstream fout(path.c_str());
+	if (!fout) {
+		throw std::runtime_error("Failed to open " + path + " to write frame timings");
+	}
+	// Keep the system time's fraction, it counts from boot on some platforms
+	fout.precision(12);
+	const bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+	if (json) {
+		fout << "[\n";
+	} else {
+		fout << "frame_index,system_time,gpu_ms,compositor_gpu_ms,cpu_wait_ms,"
+			<< "frame_interval_ms,presents,mispresented,dropped,reprojection_flags\n";
+	}
+	for (size_t i = 0; i < timings.size(); ++i) {
+		const FrameTiming &t = timings[i];
+		if (json) {
+			fout << "  {\"frame_index\": " << t.frame_index
+				<< ", \"system_time\": " << t.system_time
+				<< ", \"gpu_ms\": " << t.gpu_ms
+				<< ", \"compositor_gpu_ms\": " << t.compositor_gpu_ms
+				<< ", \"cpu_wait_ms\": " << t.cpu_wait_ms
+				<< ", \"frame_interval_ms\": " << t.frame_interval_ms
+				<< ", \"presents\": " << t.presents
+				<< ", \"mispresented\": " << t.mispresented
+				<< ", \"dropped\": " << t.dropped
+				<< ", \"reprojection_flags\": " << t.reprojection_flags
+				<< (i + 1 < timings.size() ? "},\n" : "}\n");
+		} else {
+			fout << t.frame_index << "," << t.system_time << "," << t.gpu_ms << ","
+				<< t.compositor_gpu_ms << "," << t.cpu_wait_ms << "," << t.frame_interval_ms << ","
+				<< t.presents << "," << t.mispresented << "," << t.dropped << ","
+				<< t.reprojection_flags << "\n";
+		}
+	}
+	if (json) {
+		fout << "]\n";
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// How a frame fared in the compositor, from OpenVR's Compositor_FrameTiming
+// or the mock backend's emulated vsync. Fields the backend doesn't measure
+// are left at 0
+struct FrameTiming {
+	uint32_t frame_index;
+	// When the frame started, in seconds
+	double system_time;
+	// The GPU time spent rendering the frame, and by the compositor on it
+	float gpu_ms;
+	float compositor_gpu_ms;
+	// Time the frame was blocked waiting for poses before rendering
+	float cpu_wait_ms;
+	// Time since the previous frame started
+	float frame_interval_ms;
+	// Times the frame was shown, more than once if the next one was late
+	uint32_t presents;
+	uint32_t mispresented;
+	// Frames the compositor dropped waiting on us, showing this one again
+	uint32_t dropped;
+	// Non-zero if the compositor had to reproject the frame
+	uint32_t reprojection_flags;
+
+	FrameTiming();
+};
+
+// A fixed-size ring of the most recent items, where a single producer
+// overwrites the oldest and any thread can take a snapshot without
+// blocking it. Each slot has a sequence number that's odd while it's being
+// written, and readers retry or skip slots which changed under them.
+template<typename T>
+struct TelemetryRing {
+	// The capacity must be a power of two
+	TelemetryRing(size_t capacity)
+		: slots(new Slot[capacity]), mask(capacity - 1), head(0)
+	{
+		if (capacity < 2 || (capacity & mask) != 0) {
+			throw std::runtime_error("TelemetryRing capacity must be a power of two");
+		}
+		for (size_t i = 0; i < capacity; ++i) {
+			slots[i].sequence.store(0, std::memory_order_relaxed);
+		}
+	}
+	TelemetryRing(const TelemetryRing&) = delete;
+	TelemetryRing& operator=(const TelemetryRing&) = delete;
+
+	// Append an item, overwriting the oldest once the ring is full. Only
+	// one thread may push
+	void push(const T &item) {
+		const uint64_t pos = head.load(std::memory_order_relaxed);
+		Slot &slot = slots[pos & mask];
+		slot.sequence.store(2 * pos + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.value = item;
+		slot.sequence.store(2 * pos + 2, std::memory_order_release);
+		head.store(pos + 1, std::memory_order_release);
+	}
+	// Copy out the items currently in the ring, oldest first. Items being
+	// overwritten while they're copied are left out
+	std::vector<T> snapshot() const {
+		const uint64_t end = head.load(std::memory_order_acquire);
+		const uint64_t capacity = mask + 1;
+		const uint64_t begin = end > capacity ? end - capacity : 0;
+		std::vector<T> items;
+		items.reserve(end - begin);
+		for (uint64_t pos = begin; pos < end; ++pos) {
+			const Slot &slot = slots[pos & mask];
+			const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+			T value = slot.value;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const uint64_t after = slot.sequence.load(std::memory_order_relaxed);
+			if (before == 2 * pos + 2 && after == before) {
+				items.push_back(value);
+			}
+		}
+		return items;
+	}
+	// Number of items ever pushed
+	uint64_t size() const {
+		return head.load(std::memory_order_acquire);
+	}
+
+	struct Slot {
+		std::atomic<uint64_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Slot[]> slots;
+	const uint64_t mask;
+	std::atomic<uint64_t> head;
+};
+
+// Totals over a run of frame timings
+struct FrameTimingSummary {
+	size_t frames;
+	uint64_t dropped, mispresented, reprojected;
+	float average_gpu_ms, max_gpu_ms;
+	float average_cpu_wait_ms;
+
+	FrameTimingSummary(const std::vector<FrameTiming> &timings);
+};
+
+// Write the timings to a file, as JSON if the name ends in .json and CSV
+// with a header row otherwise
+void write_frame_timings(const std::string &path, const std::vector<FrameTiming> &timings);
@@ -0,0 +1,57 @@
+#include "gl_timer.h"
+
+GLTimer::GLTimer(size_t num_queries)
+	: queries(num_queries, 0), pending(num_queries, false), next(0),
+	total_ms(0.0), samples(0)
+{
+	glGenQueries(queries.size(), queries.data());
+}
+GLTimer::~GLTimer() {
+	glDeleteQueries(queries.size(), queries.data());
+}
+void GLTimer::begin() {
+	// If the GPU is this far behind we have to wait for the oldest result
+	// before its query can be reused
+	if (pending[next]) {
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(queries[next], GL_QUERY_RESULT, &ns);
+		total_ms += ns / 1e6;
+		++samples;
+		pending[next] = false;
+	}
+	glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+}
+void GLTimer::end() {
+	glEndQuery(GL_TIME_ELAPSED);
+	pending[next] = true;
+	next = (next + 1) % queries.size();
+}
+void GLTimer::collect(bool wait) {
+	// Walk the queries oldest first, results become available in order
+	for (size_t i = 0; i < queries.size(); ++i) {
+		const size_t q = (next + i) % queries.size();
+		if (!pending[q]) {
+			continue;
+		}
+		if (!wait) {
+			GLint available = 0;
+			glGetQueryObjectiv(queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				break;
+			}
+		}
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(queries[q], GL_QUERY_RESULT, &ns);
+		total_ms += ns / 1e6;
+		++samples;
+		pending[q] = false;
+	}
+}
+float GLTimer::average_ms() const {
+	return samples > 0 ? static_cast<float>(total_ms / samples) : 0.f;
+}
+void GLTimer::reset() {
+	total_ms = 0.0;
+	samples = 0;
+}
+
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+#include <GL/gl3w.h>
+
+// Measures the GPU time taken by GL commands with GL_TIME_ELAPSED queries.
+// A few queries are kept in flight so timing every frame doesn't stall on
+// the results, which are collected once the GPU has finished with them.
+struct GLTimer {
+	GLTimer(size_t num_queries = 4);
+	~GLTimer();
+	GLTimer(const GLTimer&) = delete;
+	GLTimer& operator=(const GLTimer&) = delete;
+	// Time the commands issued between begin and end. Timers can't be
+	// nested or overlap with other GL_TIME_ELAPSED queries
+	void begin();
+	void end();
+	// Collect the results of finished queries, or wait for all of them
+	void collect(bool wait = false);
+	// Average time of the collected queries in milliseconds
+	float average_ms() const;
+	void reset();
+
+	std::vector<GLuint> queries;
+	std::vector<bool> pending;
+	size_t next;
+	double total_ms;
+	size_t samples;
+};
+
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "triple_buffer.h"
+#include "handoff_benchmark.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchmarkFrame {
+	std::vector<uint32_t> pixels;
+	Clock::time_point published;
+};
+
+struct HandoffStat {
+	double total, max;
+	size_t count;
+
+	HandoffStat() : total(0.0), max(0.0), count(0) {}
+	void add(double v) {
+		total += v;
+		max = std::max(max, v);
+		++count;
+	}
+	double average() const {
+		return count > 0 ? total / count : 0.0;
+	}
+};
+
+struct HandoffResults {
+	size_t rendered, published, displayed;
+	// Time spent publishing and mapping in microseconds, and from a frame
+	// being published to the display mapping it in milliseconds
+	HandoffStat publish_us, map_us, latency_ms;
+
+	HandoffResults() : rendered(0), published(0), displayed(0) {}
+};
+
+// The double buffer and mutex PanoramaRenderEngine used before: the
+// render thread drops its frame if the display holds the lock, and the
+// display holds it while uploading
+struct MutexDoubleBuffer {
+	std::array<BenchmarkFrame, 2> frames;
+	size_t front;
+	bool new_frame;
+	std::mutex mutex;
+
+	MutexDoubleBuffer() : front(0), new_frame(false) {}
+	BenchmarkFrame& back_buffer() {
+		return frames[1 - front];
+	}
+	bool publish() {
+		if (!mutex.try_lock()) {
+			return false;
+		}
+		front = 1 - front;
+		new_frame = true;
+		mutex.unlock();
+		return true;
+	}
+	BenchmarkFrame* map() {
+		mutex.lock();
+		if (!new_frame) {
+			return nullptr;
+		}
+		new_frame = false;
+		return &frames[front];
+	}
+	void unmap() {
+		mutex.unlock();
+	}
+};
+
+struct TripleBufferHandoff {
+	TripleBuffer<BenchmarkFrame> frames;
+
+	BenchmarkFrame& back_buffer() {
+		return frames.back_buffer();
+	}
+	bool publish() {
+		frames.publish();
+		return true;
+	}
+	BenchmarkFrame* map() {
+		return frames.acquire() ? &frames.front_buffer() : nullptr;
+	}
+	void unmap() {}
+};
+
+template<typename Handoff>
+static HandoffResults run_handoff(Handoff &handoff, const std::vector<uint32_t> &image,
+		float refresh_rate, float seconds)
+{
+	using namespace std::chrono;
+	HandoffResults results;
+	std::atomic<bool> running(true);
+	// The render thread writes each frame into the back buffer like
+	// PanoramaRenderEngine::publish, then hands it off
+	std::thread render_thread([&]() {
+		while (running) {
+			BenchmarkFrame &back = handoff.back_buffer();
+			back.pixels.resize(image.size());
+			std::memcpy(back.pixels.data(), image.data(), image.size() * sizeof(uint32_t));
+			++results.rendered;
+			const Clock::time_point start = Clock::now();
+			back.published = start;
+			if (handoff.publish()) {
+				++results.published;
+			}
+			results.publish_us.add(duration<double, std::micro>(Clock::now() - start).count());
+		}
+	});
+
+	std::vector<uint32_t> upload(image.size());
+	const Clock::duration period = duration_cast<Clock::duration>(duration<double>(1.0 / refresh_rate));
+	Clock::time_point next = Clock::now();
+	const Clock::time_point end = next + duration_cast<Clock::duration>(duration<double>(seconds));
+	while (next < end) {
+		next += period;
+		std::this_thread::sleep_until(next);
+		const Clock::time_point start = Clock::now();
+		BenchmarkFrame *frame = handoff.map();
+		const Clock::time_point mapped = Clock::now();
+		results.map_us.add(duration<double, std::micro>(mapped - start).count());
+		if (frame) {
+			results.latency_ms.add(duration<double, std::milli>(mapped - frame->published).count());
+			std::memcpy(upload.data(), frame->pixels.data(), upload.size() * sizeof(uint32_t));
+			++results.displayed;
+		}
+		handoff.unmap();
+	}
+	running = false;
+	render_thread.join();
+	return results;
+}
+
+static void print_handoff(const std::string &name, const HandoffResults &r) {
+	std::cout << name << ": " << r.rendered << " frames rendered, " << r.published
+		<< " published, " << r.displayed << " displayed\n"
+		<< "\tpublish: " << r.publish_us.average() << "us average, "
+		<< r.publish_us.max << "us max\n"
+		<< "\tmap: " << r.map_us.average() << "us average, " << r.map_us.max << "us max\n"
+		<< "\tlatency: " << r.latency_ms.average() << "ms average, "
+		<< r.latency_ms.max << "ms max\n";
+}
+
+void benchmark_frame_handoff(int width, int height, float refresh_rate, float seconds) {
+	std::vector<uint32_t> image(size_t(width) * height);
+	for (size_t i = 0; i < image.size(); ++i) {
+		image[i] = static_cast<uint32_t>(i * 2654435761u);
+	}
+	std::cout << "Handing off " << width << "x" << height << " frames to a " << refresh_rate
+		<< "Hz display for " << seconds << "s each\n";
+	{
+		MutexDoubleBuffer handoff;
+		print_handoff("Mutex double buffer", run_handoff(handoff, image, refresh_rate, seconds));
+	}
+	{
+		TripleBufferHandoff handoff;
+		print_handoff("Triple buffer", run_handoff(handoff, image, refresh_rate, seconds));
+	}
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// Measure handing width x height RGBA8 frames from a render thread to a
+// display thread running at refresh_rate Hz, through the engine's
+// TripleBuffer and through the double buffer and mutex it replaced. The
+// render thread publishes as fast as it can, the display thread copies
+// out each new frame like an upload would. Prints how long each side spent
+// in the handoff, how many frames were dropped, and the latency from a
+// frame being published to the display picking it up.
+void benchmark_frame_handoff(int width, int height, float refresh_rate, float seconds);
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cmath>
+#include "hidden_area_mask.h"
+
+HiddenAreaMesh synthetic_hidden_area_mesh(size_t segments) {
+	const float PI = 3.14159265358979f;
+	HiddenAreaMesh mesh;
+	for (int q = 0; q < 4; ++q) {
+		const float start = q * PI / 2.f;
+		const float mid = start + PI / 4.f;
+		// The region between the ellipse and the corner is in view of
+		// the corner, so a fan from it covers the region exactly
+		const glm::vec2 corner(std::cos(mid) > 0.f ? 1.f : 0.f, std::sin(mid) > 0.f ? 1.f : 0.f);
+		for (size_t i = 0; i < segments; ++i) {
+			const float a = start + i * (PI / 2.f) / segments;
+			const float b = start + (i + 1) * (PI / 2.f) / segments;
+			mesh.push_back(corner);
+			mesh.push_back(glm::vec2(0.5f + 0.5f * std::cos(a), 0.5f + 0.5f * std::sin(a)));
+			mesh.push_back(glm::vec2(0.5f + 0.5f * std::cos(b), 0.5f + 0.5f * std::sin(b)));
+		}
+	}
+	return mesh;
+}
+
+HiddenAreaMask::HiddenAreaMask(GLuint program, const std::array<HiddenAreaMesh, 2> &meshes)
+	: program(program), depth_unif(glGetUniformLocation(program, "depth")), vao(0), vbo(0)
+{
+	std::vector<glm::vec2> verts = {glm::vec2(0, 0), glm::vec2(2, 0), glm::vec2(0, 2)};
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		first[i] = verts.size();
+		count[i] = meshes[i].size() - meshes[i].size() % 3;
+		verts.insert(verts.end(), meshes[i].begin(), meshes[i].begin() + count[i]);
+
+		// The mesh's triangles don't overlap, so their areas add up
+		float area = 0.f;
+		for (GLsizei t = 0; t < count[i]; t += 3) {
+			const glm::vec2 e1 = meshes[i][t + 1] - meshes[i][t];
+			const glm::vec2 e2 = meshes[i][t + 2] - meshes[i][t];
+			area += std::abs(e1.x * e2.y - e1.y * e2.x) / 2.f;
+		}
+		hidden_area[i] = std::min(area, 1.f);
+	}
+
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &vbo);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * verts.size(), verts.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	glBindVertexArray(0);
+}
+HiddenAreaMask::~HiddenAreaMask() {
+	glDeleteProgram(program);
+	glDeleteVertexArrays(1, &vao);
+	glDeleteBuffers(1, &vbo);
+}
+void HiddenAreaMask::draw(size_t eye) {
+	GLint prev_program = 0, prev_vao = 0, prev_depth_func = 0;
+	GLboolean prev_depth_mask = GL_TRUE;
+	std::array<GLboolean, 4> prev_color_mask;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &prev_program);
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &prev_vao);
+	glGetIntegerv(GL_DEPTH_FUNC, &prev_depth_func);
+	glGetBooleanv(GL_DEPTH_WRITEMASK, &prev_depth_mask);
+	glGetBooleanv(GL_COLOR_WRITEMASK, prev_color_mask.data());
+	const GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+
+	glUseProgram(program);
+	glBindVertexArray(vao);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_ALWAYS);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+	// Reset the viewport to the far plane, then put the hidden area on the
+	// near plane. This avoids clearing, which would hit the other eye's
+	// half of a side by side target
+	glUniform1f(depth_unif, 1.f);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	if (count[eye] > 0) {
+		glUniform1f(depth_unif, -1.f);
+		glDrawArrays(GL_TRIANGLES, first[eye], count[eye]);
+	}
+
+	glUseProgram(prev_program);
+	glBindVertexArray(prev_vao);
+	glDepthFunc(prev_depth_func);
+	glDepthMask(prev_depth_mask);
+	glColorMask(prev_color_mask[0], prev_color_mask[1], prev_color_mask[2], prev_color_mask[3]);
+	if (!depth_test) {
+		glDisable(GL_DEPTH_TEST);
+	}
+}
+float HiddenAreaMask::hidden_fraction(size_t eye) const {
+	return hidden_area[eye];
+}
+
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <glm/glm.hpp>
+#include <GL/gl3w.h>
+
+// The triangles of an eye's hidden area mesh, in the eye buffer's [0, 1]
+// texture space with the origin at the top left, as OpenVR returns them
+using HiddenAreaMesh = std::vector<glm::vec2>;
+
+// A stand in for the hidden area mesh to test with without a headset: the
+// corners of the eye buffer outside the ellipse inscribed in it, roughly
+// what a round lens hides, as a fan of segments triangles per corner
+HiddenAreaMesh synthetic_hidden_area_mesh(size_t segments = 16);
+
+// Masks out the pixels of the eye buffers the lenses hide by putting them
+// on the near plane of the depth buffer, so a less than depth test rejects
+// the panorama's fragments there before they're shaded. Drawn once into
+// the eye buffers' depth, the mask stays as long as the panorama is drawn
+// without writing depth.
+struct HiddenAreaMask {
+	// The program draws the mesh at the NDC depth given by its "depth"
+	// uniform, see vsrc_hidden_area and fsrc_hidden_area in main.cpp. The
+	// mask takes ownership of the program
+	HiddenAreaMask(GLuint program, const std::array<HiddenAreaMesh, 2> &meshes);
+	~HiddenAreaMask();
+	HiddenAreaMask(const HiddenAreaMask&) = delete;
+	HiddenAreaMask& operator=(const HiddenAreaMask&) = delete;
+	// Write the eye's mask into the depth buffer of the bound framebuffer
+	// within the viewport, resetting the rest of the viewport to the far
+	// plane. Color isn't written, and the GL state changed is restored
+	void draw(size_t eye);
+	// The fraction of the eye buffer that's hidden
+	float hidden_fraction(size_t eye) const;
+
+	GLuint program;
+	GLint depth_unif;
+	GLuint vao, vbo;
+	// The buffer starts with a triangle covering the viewport, followed
+	// by each eye's mesh
+	std::array<GLint, 2> first;
+	std::array<GLsizei, 2> count;
+	std::array<float, 2> hidden_area;
+};
+
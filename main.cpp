@@ -18,10 +18,17 @@
 #include <array>
 #include <iostream>
 #include <vector>
+#include <memory>
 #include <atomic>
 #include <thread>
 #include <mutex>
 #include <sstream>
+#include <deque>
+#include <cmath>
+#include <functional>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -44,9 +51,22 @@
 #include "ospcommon/utility/SaveImage.h"
 #include "sg/geometry/TriangleMesh.h"
 #include "widgets/imguiViewer.h"
-#include "common/util/AsyncRenderEngine.h"
 
 #include "openvr_display.h"
+#include "openvr_backend.h"
+#include "mock_vr_backend.h"
+#include "frame_pacer.h"
+#include "panorama_texture.h"
+#include "panorama_render_engine.h"
+#include "persistent_panorama_ring.h"
+#include "panorama_uploader.h"
+#include "handoff_benchmark.h"
+#include "view_region.h"
+#include "resolution_governor.h"
+#include "envmap_lut.h"
+#include "gl_timer.h"
+#include "cube_map_converter.h"
+#include "hidden_area_mask.h"
 #include "gldebug.h"
 
 using namespace ospcommon;
@@ -72,35 +92,264 @@ static const std::array<float, 42> CUBE_STRIP = {
 const int MIRROR_WIDTH = 720;
 const int MIRROR_HEIGHT = 800;
 
+// Vertex shader for drawing the panorama. Compiled with FULLSCREEN_TRIANGLE
+// it draws one triangle covering the viewport instead of the cube around
+// the viewer, see --fullscreen-sky. Compiled with SINGLE_PASS_STEREO
+// it draws both eyes at once as two instances, each sent to its layer of
+// the eye texture array. The layer is written here when the driver
+// supports it from the vertex shader, otherwise LAYER_GEOMETRY_SHADER
+// passes it on to gsrc_layer to write. SINGLE_PASS_STEREO needs VIEWS_UBO,
+// which takes the matrices from the Views uniform buffer instead of the
+// proj_view uniform
 const static std::string vsrc = R"(
 #version 330 core
+#if defined(SINGLE_PASS_STEREO) && !defined(LAYER_GEOMETRY_SHADER)
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_layer : enable
+#endif
 layout(location = 0) in vec3 pos;
+#ifdef VIEWS_UBO
+// The left and right eyes, then the mirror window
+layout(std140) uniform Views {
+  mat4 proj_views[3];
+};
+uniform int first_view;
+#else
 uniform mat4 proj_view;
+#endif
+#if defined(SINGLE_PASS_STEREO) && defined(LAYER_GEOMETRY_SHADER)
+#define vdir layer_vdir
+flat out int layer;
+#endif
 out vec3 vdir;
 void main(void) {
-  gl_Position = proj_view * vec4(pos, 1);
+#ifdef SINGLE_PASS_STEREO
+  mat4 view_proj = proj_views[first_view + gl_InstanceID];
+#ifdef LAYER_GEOMETRY_SHADER
+  layer = gl_InstanceID;
+#else
+  gl_Layer = gl_InstanceID;
+#endif
+#elif defined(VIEWS_UBO)
+  mat4 view_proj = proj_views[first_view];
+#else
+  mat4 view_proj = proj_view;
+#endif
+#ifdef FULLSCREEN_TRIANGLE
+  // Unproject the corners to the far plane to get the view directions
+  // through them. The view has no translation, so the directions are
+  // linear in screen space and interpolate exactly without the divide
+  vec2 ndc = vec2(float((gl_VertexID & 1) * 4 - 1), float((gl_VertexID >> 1) * 4 - 1));
+  gl_Position = vec4(ndc, 0, 1);
+  vdir = (inverse(view_proj) * vec4(ndc, 1, 1)).xyz;
+#else
+  gl_Position = view_proj * vec4(pos, 1);
   vdir = pos.xyz;
+#endif
 }
 )";
 
+// Sends each triangle to the eye texture array layer picked by vsrc, for
+// drivers that can't write gl_Layer from the vertex shader
+const static std::string gsrc_layer = R"(
+#version 330 core
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+in vec3 layer_vdir[];
+flat in int layer[];
+out vec3 vdir;
+void main(void) {
+  for (int i = 0; i < 3; ++i) {
+    gl_Position = gl_in[i].gl_Position;
+    gl_Layer = layer[i];
+    vdir = layer_vdir[i];
+    EmitVertex();
+  }
+  EndPrimitive();
+}
+)";
+
+// Fragment shader for equirectangular panoramas. Compiled with FAST_TRIG
+// it uses polynomial approximations of atan and acos, and with UV_LUT it
+// looks the texture coordinates up from create_equirect_uv_lut's cube map
+// instead of computing them, see --envmap-lookup
 const static std::string fsrc = R"(
 #version 330 core
 uniform sampler2D envmap;
+#ifdef UV_LUT
+uniform samplerCube uv_lut;
+#endif
 out vec4 color;
 in vec3 vdir;
-void main(void) {
-  const float PI = 3.1415926535897932384626433832795;
 
+const float PI = 3.1415926535897932384626433832795;
+
+#ifdef FAST_TRIG
+// Accurate to about 1e-5 radians
+float fast_atan2(float y, float x) {
+  float ax = abs(x);
+  float ay = abs(y);
+  float a = min(ax, ay) / max(max(ax, ay), 1e-20);
+  float s = a * a;
+  float r = a * (0.9998660 + s * (-0.3302995 + s * (0.1801410 + s * (-0.0851330 + s * 0.0208351))));
+  r = ay > ax ? PI / 2 - r : r;
+  r = x < 0.0 ? PI - r : r;
+  return y < 0.0 ? -r : r;
+}
+// Accurate to about 7e-5 radians (Abramowitz and Stegun 4.4.45)
+float fast_acos(float x) {
+  float ax = abs(x);
+  float r = sqrt(max(1.0 - ax, 0.0)) * (1.5707288 + ax * (-0.2121144 + ax * (0.0742610 - 0.0187293 * ax)));
+  return x < 0.0 ? PI - r : r;
+}
+#endif
+
+void main(void) {
+#ifdef UV_LUT
+  vec3 lut = texture(uv_lut, vdir).xyz;
+  // u wraps around in the -Z half, where the LUT's shifted copy doesn't
+  float u = vdir.z < 0.0 ? lut.y - 0.5 : lut.x;
+  float v = lut.z;
+#else
   vec3 dir = normalize(vdir);
   // Note: The panoramic camera uses flipped theta/phi terminology
   // compared to wolfram alpha or other parametric sphere equations
   // In the map phi goes along x from [0, 2pi] and theta goes along y [0, pi]
+#ifdef FAST_TRIG
+  float u = (fast_atan2(dir.z, dir.x) + PI / 2) / (2 * PI);
+  float v = fast_acos(dir.y) / PI;
+#else
   float u = (atan(dir.z, dir.x) + PI / 2) / (2 * PI);
   float v = acos(dir.y) / PI;
+#endif
+#endif
   color = texture(envmap, vec2(u, v));
 }
 )";
 
+// A triangle covering the viewport, drawn without any vertex buffers
+const static std::string vsrc_fullscreen = R"(
+#version 330 core
+out vec2 ndc;
+void main(void) {
+  ndc = vec2(float((gl_VertexID & 1) * 4 - 1), float((gl_VertexID >> 1) * 4 - 1));
+  gl_Position = vec4(ndc, 0, 1);
+}
+)";
+
+// Renders a face of a cube map from the equirectangular panorama, for
+// --convert-cube-map. The mapping matches fsrc, and the faces follow the
+// GL spec's cube map table like the cubemap camera
+const static std::string fsrc_equirect_to_cube = R"(
+#version 330 core
+uniform sampler2D equirect;
+uniform int face;
+in vec2 ndc;
+out vec4 color;
+void main(void) {
+  const float PI = 3.1415926535897932384626433832795;
+
+  float sc = ndc.x;
+  float tc = ndc.y;
+  vec3 dir;
+  if (face == 0) {
+    dir = vec3(1, -tc, -sc);
+  } else if (face == 1) {
+    dir = vec3(-1, -tc, sc);
+  } else if (face == 2) {
+    dir = vec3(sc, 1, tc);
+  } else if (face == 3) {
+    dir = vec3(sc, -1, -tc);
+  } else if (face == 4) {
+    dir = vec3(sc, -tc, 1);
+  } else {
+    dir = vec3(-sc, -tc, -1);
+  }
+  dir = normalize(dir);
+  float u = (atan(dir.z, dir.x) + PI / 2) / (2 * PI);
+  float v = acos(dir.y) / PI;
+  color = textureLod(equirect, vec2(u, v), 0);
+}
+)";
+
+// Draws the hidden area mesh, whose vertices are in the eye buffer's [0, 1]
+// texture space with the origin at the top left, see HiddenAreaMask
+const static std::string vsrc_hidden_area = R"(
+#version 330 core
+layout(location = 0) in vec2 pos;
+uniform float depth;
+void main(void) {
+  gl_Position = vec4(pos.x * 2 - 1, 1 - pos.y * 2, depth, 1);
+}
+)";
+
+// The hidden area mask only writes depth
+const static std::string fsrc_hidden_area = R"(
+#version 330 core
+void main(void) {}
+)";
+
+// Fragment shader with a flat color, the baseline of --benchmark-envmap
+const static std::string fsrc_flat = R"(
+#version 330 core
+out vec4 color;
+in vec3 vdir;
+void main(void) {
+  color = vec4(0.5, 0.5, 0.5, 1);
+}
+)";
+
+// Fragment shader for cube map panoramas, see PanoramaLayout::CUBE_MAP
+const static std::string fsrc_cube = R"(
+#version 330 core
+uniform samplerCube envmap;
+out vec4 color;
+in vec3 vdir;
+void main(void) {
+  color = texture(envmap, vdir);
+}
+)";
+
+// Fragment shader for equi-angular cube maps, where texels are spaced
+// evenly in angle across each face instead of evenly on the face plane
+const static std::string fsrc_eac = R"(
+#version 330 core
+uniform samplerCube envmap;
+out vec4 color;
+in vec3 vdir;
+void main(void) {
+  const float PI = 3.1415926535897932384626433832795;
+
+  // Project onto the cube so the major axis is +/-1 and the face coordinates
+  // are the other two, then warp those from tangent to angle space. The
+  // major axis stays at +/-1 (atan(1) = PI / 4), so the hardware cube map
+  // lookup picks the same face and filters across the edges as usual.
+  vec3 a = abs(vdir);
+  vec3 dir = vdir / max(a.x, max(a.y, a.z));
+  color = texture(envmap, atan(dir) * (4.0 / PI));
+}
+)";
+
+// Fragment shader for foveated panoramas, undoes the foveated camera's
+// warp around the gaze direction the displayed panorama was rendered for
+const static std::string fsrc_foveated = R"(
+#version 330 core
+uniform sampler2D envmap;
+// Right, up and forward axes of the gaze frame, see gaze_frame
+uniform mat3 gaze_frame;
+uniform float foveation;
+out vec4 color;
+in vec3 vdir;
+void main(void) {
+  const float PI = 3.1415926535897932384626433832795;
+
+  // Azimuth and elevation about the gaze, normalized to [-1, 1]
+  vec3 dir = normalize(vdir) * gaze_frame;
+  vec2 angle = vec2(atan(dir.x, dir.z) / PI, asin(clamp(dir.y, -1.0, 1.0)) / (PI / 2));
+  vec2 st = asinh(angle * sinh(foveation)) / foveation;
+  color = texture(envmap, st * 0.5 + 0.5);
+}
+)";
 
 //
 // sg stuff
@@ -111,6 +360,39 @@ bool addPlane = true;
 bool debug = false;
 bool fullscreen = false;
 bool print = false;
+bool persistentUpload = false;
+bool dirtyTiles = false;
+bool streamTiles = false;
+bool cubeMap = false;
+bool equiAngular = false;
+bool foveated = false;
+bool viewPriority = false;
+bool progressive = false;
+bool autoSize = false;
+float sizeQuality = 1.f;
+std::string envmapLookup = "exact";
+bool benchmarkEnvmap = false;
+bool convertCubeMap = false;
+bool singlePassStereo = false;
+bool lateLatch = false;
+bool leanEyeTargets = false;
+bool maskHiddenArea = false;
+bool mockVR = false;
+float mockRefreshRate = 90.f;
+std::string poseTraceFile;
+std::string recordPosesFile;
+std::string mockCapturePrefix;
+std::string frameTimingFile;
+bool runningStart = false;
+bool vrRenderThread = false;
+bool asyncUpload = false;
+bool benchmarkHandoff = false;
+float runningStartLead = 4.f;
+bool fullscreenSky = false;
+bool benchmarkSky = false;
+float governorRate = 0.f;
+float governorMinScale = 0.5f;
+float governorMaxScale = 2.f;
 
 void parseCommandLine(int ac, const char **&av)
 {
@@ -128,6 +410,71 @@ void parseCommandLine(int ac, const char **&av)
       print=true;
     } else if (arg == "--fullscreen") {
       fullscreen = true;
+    } else if (arg == "--persistent-upload") {
+      persistentUpload = true;
+    } else if (arg == "--dirty-tiles") {
+      dirtyTiles = true;
+    } else if (arg == "--stream-tiles") {
+      streamTiles = true;
+    } else if (arg == "--cube-map") {
+      cubeMap = true;
+    } else if (arg == "--eac") {
+      cubeMap = true;
+      equiAngular = true;
+    } else if (arg == "--foveated") {
+      foveated = true;
+    } else if (arg == "--view-priority") {
+      viewPriority = true;
+    } else if (arg == "--progressive") {
+      progressive = true;
+    } else if (arg == "--auto-size") {
+      autoSize = true;
+    } else if (arg == "--quality") {
+      sizeQuality = std::stof(av[++i]);
+    } else if (arg == "--envmap-lookup") {
+      envmapLookup = av[++i];
+    } else if (arg == "--fullscreen-sky") {
+      fullscreenSky = true;
+    } else if (arg == "--benchmark-sky") {
+      benchmarkSky = true;
+    } else if (arg == "--mock-vr") {
+      mockVR = true;
+    } else if (arg == "--mock-refresh") {
+      mockRefreshRate = std::stof(av[++i]);
+    } else if (arg == "--pose-trace") {
+      poseTraceFile = av[++i];
+    } else if (arg == "--mock-capture") {
+      mockCapturePrefix = av[++i];
+    } else if (arg == "--record-poses") {
+      recordPosesFile = av[++i];
+    } else if (arg == "--frame-timing") {
+      frameTimingFile = av[++i];
+    } else if (arg == "--benchmark-handoff") {
+      benchmarkHandoff = true;
+    } else if (arg == "--async-upload") {
+      asyncUpload = true;
+    } else if (arg == "--vr-thread") {
+      vrRenderThread = true;
+    } else if (arg == "--running-start") {
+      runningStart = true;
+      runningStartLead = std::stof(av[++i]);
+    } else if (arg == "--hidden-area-mask") {
+      maskHiddenArea = true;
+    } else if (arg == "--lean-eye-targets") {
+      leanEyeTargets = true;
+    } else if (arg == "--single-pass-stereo") {
+      singlePassStereo = true;
+    } else if (arg == "--late-latch") {
+      lateLatch = true;
+    } else if (arg == "--convert-cube-map") {
+      convertCubeMap = true;
+    } else if (arg == "--benchmark-envmap") {
+      benchmarkEnvmap = true;
+    } else if (arg == "--governor") {
+      governorRate = std::stof(av[++i]);
+    } else if (arg == "--governor-scale") {
+      governorMinScale = std::stof(av[++i]);
+      governorMaxScale = std::stof(av[++i]);
     } else if (arg[0] != '-') {
       files.push_back(av[i]);
     }
@@ -214,8 +561,216 @@ void parseCommandLineSG(int ac, const char **&av, sg::Node &root)
 
 const int PANORAMIC_HEIGHT = 512;
 const int PANORAMIC_WIDTH = 2 * PANORAMIC_HEIGHT;
+// Strength of the foveated camera's warp. At 2.18 the panorama is half
+// as wide and tall as the equirectangular one for the same resolution
+// around the gaze, dropping to about a fifth of it behind the viewer
+const float FOVEATION = 2.18f;
+// Re-centering the foveated panorama restarts its accumulation, so the
+// gaze has to move this far (20 degrees) from the current center first
+const float FOVEATION_RECENTER_COS = 0.94f;
+
+// Build the right, up and forward axes of the foveated camera's frame
+// around a gaze direction, matching FoveatedCamera::commit
+glm::mat3 gaze_frame(const glm::vec3 &gaze) {
+  const glm::vec3 gz = glm::normalize(gaze);
+  const glm::vec3 gy = std::abs(gz.y) < 0.999f
+    ? glm::normalize(glm::vec3(0, 1, 0) - gz * gz.y)
+    : glm::vec3(0, 0, gz.y > 0 ? 1 : -1);
+  return glm::mat3(glm::cross(gy, gz), gy, gz);
+}
+
+// Size the panorama so its sharpest region matches the given angular
+// resolution, in pixels per radian, and fits in a texture
+vec2i panorama_size_for_density(float density) {
+  const float PI = 3.14159265358979f;
+  vec2i size;
+  if (cubeMap) {
+    // Standard cube map faces are sharpest at their edges and coarsest at
+    // their centers, where a face of size F has F / 2 pixels per radian.
+    // Equi-angular faces spread their F pixels evenly over 90 degrees.
+    const int face = static_cast<int>(equiAngular ? density * PI / 2 : 2 * density) + 1;
+    size = vec2i(6 * face, face);
+  } else {
+    const int height = static_cast<int>(density * PI) + 1;
+    size = vec2i(2 * height, height);
+    if (foveated) {
+      const float scale = FOVEATION / std::sinh(FOVEATION);
+      size = vec2i(size.x * scale, size.y * scale);
+    }
+  }
+  GLint maxTexture = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexture);
+  // Cube map faces are stored separately, so only a face has to fit
+  const int largest = cubeMap ? size.y : std::max(size.x, size.y);
+  if (maxTexture > 0 && largest > maxTexture) {
+    size = vec2i(size.x * maxTexture / largest, size.y * maxTexture / largest);
+  }
+  return size;
+}
+
+// Face size of the direction to texture coordinate lookup cube map
+const int ENVMAP_LUT_SIZE = 256;
+
+GLuint load_shader_program(const std::string &vshader_src, const std::string &fshader_src,
+    const std::string &gshader_src = "");
+
+// Check if the context supports an extension
+bool has_gl_extension(const std::string &name) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; ++i) {
+    if (name == reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Add a #define to a shader after its #version line
+std::string with_define(const std::string &src, const std::string &define) {
+  const size_t version = src.find("#version");
+  const size_t line_end = src.find('\n', version);
+  return src.substr(0, line_end + 1) + "#define " + define + "\n" + src.substr(line_end + 1);
+}
+
+// The equirectangular shader variant for --envmap-lookup
+std::string equirect_shader(const std::string &lookup) {
+  if (lookup == "fast") {
+    return with_define(fsrc, "FAST_TRIG");
+  } else if (lookup == "lut") {
+    return with_define(fsrc, "UV_LUT");
+  }
+  return fsrc;
+}
+
+// Average GPU time of draw() with the program, which takes its view from
+// a proj_view uniform. The view sweeps around so the whole panorama, seam
+// and poles included, is covered
+float time_panorama_draws(GLuint prog, const glm::mat4 &proj, const std::function<void()> &draw) {
+  const int WARMUP_DRAWS = 20;
+  const int DRAWS = 200;
+  const GLint proj_view_unif = glGetUniformLocation(prog, "proj_view");
+
+  GLTimer timer;
+  for (int i = 0; i < WARMUP_DRAWS + DRAWS; ++i) {
+    if (i == WARMUP_DRAWS) {
+      timer.collect(true);
+      timer.reset();
+    }
+    const float a = i * 0.1f;
+    const glm::mat4 proj_view = proj * glm::lookAt(glm::vec3(0),
+        glm::vec3(std::cos(a), std::sin(2.f * a), std::sin(a)), glm::vec3(0, 1, 0));
+    glUniformMatrix4fv(proj_view_unif, 1, GL_FALSE, glm::value_ptr(proj_view));
+    timer.begin();
+    draw();
+    timer.end();
+  }
+  timer.collect(true);
+  return timer.average_ms();
+}
+
+// Draw the panorama bound on texture unit 1 with each of the equirect
+// shader's lookup variants over a width x height target and print the
+// GPU time each takes. The flat shaded baseline gives the cost of
+// everything but the fragment work, to compare the lookups against.
+void benchmark_envmap_lookups(GLuint vao, int width, int height) {
+  GLuint target, fb;
+  glGenTextures(1, &target);
+  glBindTexture(GL_TEXTURE_2D, target);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glGenFramebuffers(1, &fb);
+  glBindFramebuffer(GL_FRAMEBUFFER, fb);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+  glViewport(0, 0, width, height);
+  glDisable(GL_DEPTH_TEST);
+
+  glActiveTexture(GL_TEXTURE2);
+  const GLuint lut = create_equirect_uv_lut(ENVMAP_LUT_SIZE);
+  glActiveTexture(GL_TEXTURE0);
+
+  const std::array<std::string, 4> names = {"flat", "exact", "fast", "lut"};
+  const glm::mat4 proj = glm::perspective(glm::radians(100.f),
+      static_cast<float>(width) / height, 0.01f, 10.f);
+  std::cout << "Envmap lookup GPU time over " << width << "x" << height << ":\n";
+  float baseline = 0.f;
+  glBindVertexArray(vao);
+  for (const auto &name : names) {
+    GLuint prog = load_shader_program(vsrc, name == "flat" ? fsrc_flat : equirect_shader(name));
+    glUseProgram(prog);
+    glUniform1i(glGetUniformLocation(prog, "envmap"), 1);
+    glUniform1i(glGetUniformLocation(prog, "uv_lut"), 2);
 
-GLuint load_shader_program(const std::string &vshader_src, const std::string &fshader_src);
+    const float ms = time_panorama_draws(prog, proj, [](){
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, CUBE_STRIP.size() / 3);
+    });
+    if (name == "flat") {
+      baseline = ms;
+    }
+    std::cout << "  " << name << ": " << ms << " ms per draw, "
+      << ms - baseline << " ms over flat\n";
+    glDeleteProgram(prog);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fb);
+  glDeleteTextures(1, &target);
+  glDeleteTextures(1, &lut);
+  glEnable(GL_DEPTH_TEST);
+}
+
+// Draw the panorama bound on texture unit 1 over a width x height target
+// as the depth tested cube around the viewer, the way the eyes are drawn
+// by default, and as the fullscreen triangle of --fullscreen-sky without
+// a depth buffer, and print the GPU time each takes including the clear
+void benchmark_sky_draws(GLuint vao, int width, int height) {
+  std::array<GLuint, 2> targets;
+  glGenTextures(targets.size(), targets.data());
+  glBindTexture(GL_TEXTURE_2D, targets[0]);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+  glBindTexture(GL_TEXTURE_2D, targets[1]);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0,
+      GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+  GLuint fb;
+  glGenFramebuffers(1, &fb);
+  glBindFramebuffer(GL_FRAMEBUFFER, fb);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targets[0], 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, targets[1], 0);
+  glViewport(0, 0, width, height);
+
+  const glm::mat4 proj = glm::perspective(glm::radians(100.f),
+      static_cast<float>(width) / height, 0.01f, 10.f);
+  std::cout << "Sky draw GPU time over " << width << "x" << height << ":\n";
+  glBindVertexArray(vao);
+
+  GLuint prog = load_shader_program(vsrc, fsrc);
+  glUseProgram(prog);
+  glUniform1i(glGetUniformLocation(prog, "envmap"), 1);
+  glEnable(GL_DEPTH_TEST);
+  const float cube_ms = time_panorama_draws(prog, proj, [](){
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, CUBE_STRIP.size() / 3);
+  });
+  glDeleteProgram(prog);
+
+  prog = load_shader_program(with_define(vsrc, "FULLSCREEN_TRIANGLE"), fsrc);
+  glUseProgram(prog);
+  glUniform1i(glGetUniformLocation(prog, "envmap"), 1);
+  glDisable(GL_DEPTH_TEST);
+  const float triangle_ms = time_panorama_draws(prog, proj, [](){
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+  });
+  glDeleteProgram(prog);
+
+  std::cout << "  cube: " << cube_ms << " ms per draw\n"
+    << "  fullscreen triangle: " << triangle_ms << " ms per draw, "
+    << cube_ms - triangle_ms << " ms faster\n";
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fb);
+  glDeleteTextures(targets.size(), targets.data());
+  glEnable(GL_DEPTH_TEST);
+}
 
 int main(int argc, const char **argv) {
   if (argc < 2) {
@@ -255,6 +810,128 @@ int main(int argc, const char **argv) {
   ospcommon::LibraryRepository::getInstance()->add("ospray_sg");
 
   parseCommandLine(argc, argv);
+  // Streamed tiles don't say which gaze they were rendered for, so they
+  // can't be mixed into a foveated panorama
+  if (foveated && (cubeMap || streamTiles)) {
+    std::cout << "--foveated can't be combined with --cube-map, --eac or --stream-tiles\n";
+    return 1;
+  }
+  if (envmapLookup != "exact" && envmapLookup != "fast" && envmapLookup != "lut") {
+    std::cout << "Unknown --envmap-lookup " << envmapLookup << ", expected exact, fast or lut\n";
+    return 1;
+  }
+  if (convertCubeMap && (cubeMap || foveated)) {
+    std::cout << "--convert-cube-map only applies to equirectangular panoramas\n";
+    return 1;
+  }
+#ifndef OPENVR_ENABLED
+  if (singlePassStereo && !mockVR) {
+    std::cout << "--single-pass-stereo needs osp360 built with OpenVR, or --mock-vr\n";
+    return 1;
+  }
+  if (runningStart && !mockVR) {
+    std::cout << "--running-start needs osp360 built with OpenVR, or --mock-vr\n";
+    return 1;
+  }
+#endif
+  if (!mockVR && (!poseTraceFile.empty() || !mockCapturePrefix.empty())) {
+    std::cout << "--pose-trace and --mock-capture need --mock-vr\n";
+    return 1;
+  }
+  if (asyncUpload && (persistentUpload || streamTiles || dirtyTiles)) {
+    std::cout << "--async-upload can't be combined with --persistent-upload, --stream-tiles"
+      << " or --dirty-tiles\n";
+    return 1;
+  }
+  if (viewPriority && streamTiles) {
+    std::cout << "--view-priority can't be combined with --stream-tiles\n";
+    return 1;
+  }
+  // The module provides the cubemap and foveated cameras and tile_stream pixel op
+  if (cubeMap || foveated || streamTiles) {
+    ospLoadModule("openvr");
+  }
+
+  // Render to the headset through OpenVR, or to the mock headset to run
+  // the VR path without one. Without either only the mirror window is drawn
+  std::unique_ptr<VRBackend> vrBackend;
+  MockVRBackend *mockBackend = nullptr;
+  if (mockVR) {
+    const PoseTrace trace = poseTraceFile.empty() ? PoseTrace::synthetic(20.0, mockRefreshRate)
+      : PoseTrace::load(poseTraceFile);
+    mockBackend = new MockVRBackend(trace, mockRefreshRate);
+    // Capture about once a second, reading back every frame would stall
+    mockBackend->capture_interval = mockCapturePrefix.empty() ? 0
+      : std::max(static_cast<uint64_t>(mockRefreshRate), uint64_t(1));
+    vrBackend.reset(mockBackend);
+  }
+#ifdef OPENVR_ENABLED
+  if (!vrBackend) {
+    vrBackend.reset(new OpenVRBackend());
+  }
+#endif
+  // Lean targets put both eyes in one texture and drop the depth buffers,
+  // which the panorama doesn't need: the cube around the viewer is convex
+  // so no two faces overlap, and the fullscreen triangle is one triangle.
+  // They're kept for the hidden area mask though
+  std::unique_ptr<OpenVRDisplay> vr_display;
+  if (vrBackend) {
+    vr_display.reset(new OpenVRDisplay(std::move(vrBackend), singlePassStereo ? EyeLayout::LAYERED
+          : leanEyeTargets ? EyeLayout::SIDE_BY_SIDE : EyeLayout::SEPARATE,
+          !leanEyeTargets || maskHiddenArea));
+  }
+  // With a running start the compositor's clock drives the loop, so the
+  // mirror window mustn't block on its own vsync as well. Use adaptive
+  // vsync if the driver has it so the mirror still tears less, otherwise
+  // don't sync at all
+  std::unique_ptr<FramePacer> framePacer;
+  if (vr_display && runningStart) {
+    framePacer.reset(new FramePacer(vr_display->backend->vsync_period() * 1000.f,
+          runningStartLead));
+    if (SDL_GL_SetSwapInterval(-1) != 0) {
+      SDL_GL_SetSwapInterval(0);
+    }
+  }
+  // Optionally record the HMD's poses, to replay with --pose-trace
+  std::ofstream poseRecording;
+  const auto recordingStart = std::chrono::steady_clock::now();
+  if (!recordPosesFile.empty()) {
+    poseRecording.open(recordPosesFile.c_str());
+  }
+
+  // A cube map needs roughly 25% fewer rays than the equirectangular image
+  // for the same angular resolution at the horizon, where each face
+  // covers a quarter of the equirect image's width
+  const PanoramaLayout panoramaLayout = cubeMap ? PanoramaLayout::CUBE_MAP
+    : PanoramaLayout::EQUIRECT;
+  vec2i panoramaSize = cubeMap ? vec2i(6 * (PANORAMIC_WIDTH / 4), PANORAMIC_WIDTH / 4)
+    : vec2i(PANORAMIC_WIDTH, PANORAMIC_HEIGHT);
+  if (foveated) {
+    const float scale = FOVEATION / std::sinh(FOVEATION);
+    panoramaSize = vec2i(PANORAMIC_WIDTH * scale, PANORAMIC_HEIGHT * scale);
+  }
+  if (autoSize) {
+    // Match the resolution the eyes are rendered at, so we don't trace
+    // rays the headset can't show or blur what it can
+    const float displayDensity = vr_display ? vr_display->pixels_per_radian()
+      : (MIRROR_HEIGHT / 2.f) / std::tan(glm::radians(65.f) / 2.f);
+    panoramaSize = panorama_size_for_density(displayDensity * sizeQuality);
+    std::cout << "Panorama size for " << displayDensity << " pixels per radian: "
+      << panoramaSize.x << "x" << panoramaSize.y << std::endl;
+  }
+  // Optionally scale the panorama at runtime to render it at a target rate
+  std::unique_ptr<ResolutionGovernor> governor;
+  if (governorRate > 0.f) {
+    governor.reset(new ResolutionGovernor(panoramaSize, 1000.f / governorRate,
+          governorMinScale, governorMaxScale));
+    panoramaSize = governor->size();
+  }
+  if (benchmarkHandoff) {
+    benchmark_frame_handoff(panoramaSize.x, panoramaSize.y,
+        vr_display ? 1.f / vr_display->backend->vsync_period() : 90.f, 2.f);
+    return 0;
+  }
+
   std::shared_ptr<sg::Frame> scenegraph = std::make_shared<sg::Frame>();
   sg::Node &renderer = scenegraph->child("renderer");
 
@@ -263,16 +940,26 @@ int main(int argc, const char **argv) {
   renderer["aoSamples"].setValue(1);
   renderer["aoDistance"].setValue(500.f);
   renderer["autoEpsilon"].setValue(false);
-  auto panoramicCamera = sg::createNode("camera", "PanoramicCamera");
+  auto panoramicCamera = sg::createNode("camera",
+      cubeMap ? "CubeMapCamera" : foveated ? "FoveatedCamera" : "PanoramicCamera");
 
   scenegraph->setChild("camera", panoramicCamera);
   panoramicCamera->setParent(scenegraph);
   panoramicCamera->child("pos").setValue(ospcommon::vec3f{21, 200, -49});
   panoramicCamera->child("dir").setValue(ospcommon::vec3f{0, 0, 1});
   panoramicCamera->child("up").setValue(ospcommon::vec3f{0, -1, 0});
+  if (equiAngular) {
+    panoramicCamera->child("equiAngular").setValue(true);
+  }
+  // Start out foveated on the mirror window's view direction
+  glm::vec3 renderGaze(1, 0, 0);
+  if (foveated) {
+    panoramicCamera->child("gazeDir").setValue(ospcommon::vec3f{1, 0, 0});
+    panoramicCamera->child("foveation").setValue(FOVEATION);
+  }
   renderer["spp"].setValue(-1);
 
-  scenegraph->child("frameBuffer")["size"].setValue(ospcommon::vec2i(PANORAMIC_WIDTH, PANORAMIC_HEIGHT));
+  scenegraph->child("frameBuffer")["size"].setValue(panoramaSize);
   scenegraph->add(sg::createNode("navFrameBuffer", "FrameBuffer"), "navFrameBuffer");
   if (!initialRendererType.empty()) {
     renderer["rendererType"].setValue(initialRendererType);
@@ -320,21 +1007,130 @@ int main(int argc, const char **argv) {
   // end sg init
   //
 
-  GLuint tex;
-  glGenTextures(1, &tex);
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, tex);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, PANORAMIC_WIDTH, PANORAMIC_HEIGHT, 0,
-      GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glActiveTexture(GL_TEXTURE0);
+  // With --async-upload the uploader has the panorama textures instead
+  std::unique_ptr<PanoramaTexture> panorama;
+  if (!asyncUpload) {
+    glActiveTexture(GL_TEXTURE1);
+    panorama.reset(new PanoramaTexture(panoramaSize.x, panoramaSize.y, panoramaLayout));
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // Optionally have the renderer write panoramas straight into GL
+  // memory, instead of going through its own buffers and a PBO copy
+  std::unique_ptr<PersistentPanoramaRing> persistent_ring;
+  if (persistentUpload) {
+    if (glBufferStorage) {
+      const vec2i maxSize = governor ? governor->max_size() : panoramaSize;
+      persistent_ring.reset(new PersistentPanoramaRing(maxSize.x, maxSize.y));
+    } else {
+      std::cout << "ARB_buffer_storage is not supported, "
+        << "falling back to PBO panorama uploads" << std::endl;
+    }
+  }
+
+  // Optionally send tiles to the display as soon as they're rendered,
+  // so the panorama fills in during a frame instead of after it
+  std::unique_ptr<TileQueue> tile_queue;
+  if (streamTiles) {
+    tile_queue.reset(new TileQueue(512));
+  }
 
   std::cout << "starting async renderer" << std::endl;
-  AsyncRenderEngine async_renderer(scenegraph);
+  PanoramaRenderEngine async_renderer(scenegraph);
+  async_renderer.set_sink(persistent_ring.get());
+  async_renderer.track_dirty_tiles(dirtyTiles);
+  async_renderer.stream_tiles(tile_queue.get());
+  async_renderer.set_governor(governor.get());
+  if (progressive) {
+    // Show 1/8, 1/4 and 1/2 resolution previews after each camera change,
+    // keeping the cube map faces apart when upsampling them
+    async_renderer.set_progressive(3, cubeMap ? 6 : 1);
+  }
+
+  // Wake up this thread through an SDL event when there's a new panorama to
+  // show. Only one event is queued at a time so a fast engine can't flood
+  // the queue
+  const Uint32 newFrameEvent = SDL_RegisterEvents(1);
+  std::atomic<bool> newFrameEventPending(false);
+  auto wakeDisplay = [&newFrameEventPending, newFrameEvent]() {
+    if (!newFrameEventPending.exchange(true)) {
+      SDL_Event e = {};
+      e.type = newFrameEvent;
+      SDL_PushEvent(&e);
+    }
+  };
+
+  // Optionally upload the engine's frames on a worker thread, with its own
+  // context sharing objects with this one. The context gets a hidden window
+  // of its own, since the mirror window's surface is current on the display
+  // thread and can't be made current on a second one
+  std::unique_ptr<PanoramaUploader> uploader;
+  SDL_Window *uploadWindow = nullptr;
+  SDL_GLContext uploadCtx = nullptr;
+  if (asyncUpload) {
+    uploadWindow = SDL_CreateWindow("osp360 upload", SDL_WINDOWPOS_CENTERED,
+        SDL_WINDOWPOS_CENTERED, 1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    if (!uploadWindow) {
+      throw std::runtime_error(std::string("Failed to create the upload window: ")
+          + SDL_GetError());
+    }
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    uploadCtx = SDL_GL_CreateContext(uploadWindow);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    if (!uploadCtx) {
+      throw std::runtime_error(std::string("Failed to create the upload context: ")
+          + SDL_GetError());
+    }
+    // Creating the context made it current here
+    if (SDL_GL_MakeCurrent(window, ctx) != 0) {
+      throw std::runtime_error(std::string("Failed to make the GL context current: ")
+          + SDL_GetError());
+    }
+    glActiveTexture(GL_TEXTURE1);
+    uploader.reset(new PanoramaUploader(async_renderer, panoramaSize.x, panoramaSize.y,
+          panoramaLayout,
+          [&]() {
+            if (SDL_GL_MakeCurrent(uploadWindow, uploadCtx) != 0) {
+              std::cout << "Failed to make the upload context current: " << SDL_GetError() << "\n";
+              return false;
+            }
+            return true;
+          },
+          [&]() { SDL_GL_MakeCurrent(uploadWindow, nullptr); }, wakeDisplay));
+    glBindTexture(uploader->displayed().target, uploader->displayed().texture);
+    glActiveTexture(GL_TEXTURE0);
+  }
+  // The panorama texture being displayed
+  PanoramaTexture *shownPanorama = uploader ? &uploader->displayed() : panorama.get();
+
+  // When the engine has a new frame wake up the uploader's worker, which
+  // wakes this thread once it's uploaded, or this thread directly
+  PanoramaUploader *frameUploader = uploader.get();
+  async_renderer.set_frame_callback([wakeDisplay, frameUploader]() {
+    if (frameUploader) {
+      frameUploader->notify();
+    } else {
+      wakeDisplay();
+    }
+  });
   async_renderer.start();
 
-  glEnable(GL_DEPTH_TEST);
+  // The fullscreen triangle covers every pixel at infinity, so it doesn't
+  // need depth testing or the depth buffer cleared, except to test against
+  // the hidden area mask. The mask is kept in the eyes' depth buffers
+  // between frames so they're never cleared
+  if (!fullscreenSky || maskHiddenArea) {
+    glEnable(GL_DEPTH_TEST);
+  }
+  const GLbitfield eyeClearBits = fullscreenSky || maskHiddenArea ? GL_COLOR_BUFFER_BIT
+    : GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT;
+  const GLbitfield mirrorClearBits = fullscreenSky && !maskHiddenArea ? GL_COLOR_BUFFER_BIT
+    : GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT;
+  const GLenum skyPrimitive = fullscreenSky ? GL_TRIANGLES : GL_TRIANGLE_STRIP;
+  const GLsizei skyVertices = fullscreenSky ? 3 : CUBE_STRIP.size() / 3;
+  if (cubeMap || convertCubeMap) {
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  }
   glClearColor(0, 0, 0, 1);
   glClearDepth(1);
 
@@ -348,10 +1144,97 @@ int main(int argc, const char **argv) {
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
-  GLuint shader = load_shader_program(vsrc, fsrc);
+  const std::string displayFsrc = equiAngular ? fsrc_eac
+      : cubeMap || convertCubeMap ? fsrc_cube : foveated ? fsrc_foveated
+      : equirect_shader(envmapLookup);
+  std::string displayVsrc = fullscreenSky ? with_define(vsrc, "FULLSCREEN_TRIANGLE") : vsrc;
+  if (singlePassStereo || lateLatch) {
+    displayVsrc = with_define(displayVsrc, "VIEWS_UBO");
+  }
+  GLuint shader = 0;
+  if (singlePassStereo) {
+    displayVsrc = with_define(displayVsrc, "SINGLE_PASS_STEREO");
+    if (has_gl_extension("GL_ARB_shader_viewport_layer_array")
+        || has_gl_extension("GL_AMD_vertex_shader_layer"))
+    {
+      shader = load_shader_program(displayVsrc, displayFsrc);
+    } else {
+      shader = load_shader_program(with_define(displayVsrc, "LAYER_GEOMETRY_SHADER"),
+          displayFsrc, gsrc_layer);
+    }
+  } else {
+    shader = load_shader_program(displayVsrc, displayFsrc);
+  }
   glUseProgram(shader);
 
-  glUniform1i(glGetUniformLocation(shader, "envmap"), 1);
+  // Optionally convert each new equirect panorama to a cube map, on
+  // texture unit 3, and draw the eyes from that instead
+  std::unique_ptr<CubeMapConverter> cubeConverter;
+  if (convertCubeMap) {
+    cubeConverter.reset(new CubeMapConverter(
+          load_shader_program(vsrc_fullscreen, fsrc_equirect_to_cube)));
+  }
+
+  // Optionally mask out the eye pixels hidden by the lenses. Without a
+  // headset the mirror window is masked with a synthetic mesh instead
+  std::unique_ptr<HiddenAreaMask> hiddenArea;
+  if (maskHiddenArea) {
+    std::array<HiddenAreaMesh, 2> meshes;
+    for (size_t i = 0; i < 2; ++i) {
+      meshes[i] = vr_display ? vr_display->hidden_area_mesh(i) : synthetic_hidden_area_mesh();
+    }
+    hiddenArea.reset(new HiddenAreaMask(
+          load_shader_program(vsrc_hidden_area, fsrc_hidden_area), meshes));
+    if (vr_display) {
+      vr_display->mask_hidden_area(*hiddenArea);
+    }
+    std::cout << "Hidden area mask covers " << 100.f * hiddenArea->hidden_fraction(0)
+      << "% of the eye buffer" << std::endl;
+  }
+
+  GLuint uvLut = 0;
+  if (envmapLookup == "lut" && !cubeMap && !foveated && !convertCubeMap) {
+    glActiveTexture(GL_TEXTURE2);
+    uvLut = create_equirect_uv_lut(ENVMAP_LUT_SIZE);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(shader, "uv_lut"), 2);
+  }
+
+  // The gaze each foveated frame tag was rendered for, until a frame with
+  // that tag or a newer one is displayed
+  uint64_t gazeTag = 0;
+  std::deque<std::pair<uint64_t, glm::vec3>> pendingGazes;
+  const GLint gaze_frame_unif = glGetUniformLocation(shader, "gaze_frame");
+  if (foveated) {
+    glUniform1f(glGetUniformLocation(shader, "foveation"), FOVEATION);
+    glUniformMatrix3fv(gaze_frame_unif, 1, GL_FALSE, glm::value_ptr(gaze_frame(renderGaze)));
+  }
+  // Where view directions land in the panorama being rendered, to find
+  // the regions in view for --view-priority
+  PanoramaProjection projection(panoramaLayout, panoramaSize.x, panoramaSize.y);
+  projection.equi_angular = equiAngular;
+  projection.foveated = foveated;
+  projection.gaze_frame = gaze_frame(renderGaze);
+  projection.foveation = FOVEATION;
+  // The padded regions last given to the renderer, which are kept until
+  // the view leaves them so small head motions don't restart them
+  std::vector<TileRect> viewRegions, seenRegions;
+
+  // Point the shader at the gaze of the frame just uploaded
+  auto show_frame_tag = [&](uint64_t tag) {
+    bool changed = false;
+    glm::vec3 gaze;
+    while (!pendingGazes.empty() && pendingGazes.front().first <= tag) {
+      gaze = pendingGazes.front().second;
+      pendingGazes.pop_front();
+      changed = true;
+    }
+    if (changed) {
+      glUniformMatrix3fv(gaze_frame_unif, 1, GL_FALSE, glm::value_ptr(gaze_frame(gaze)));
+    }
+  };
+
+  glUniform1i(glGetUniformLocation(shader, "envmap"), convertCubeMap ? 3 : 1);
   const GLuint proj_view_unif = glGetUniformLocation(shader, "proj_view");
 
   const glm::mat4 proj_view = glm::perspective(glm::radians(65.f),
@@ -359,17 +1242,279 @@ int main(int argc, const char **argv) {
     * glm::lookAt(glm::vec3(0), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0));
   glUniformMatrix4fv(proj_view_unif, 1, GL_FALSE, glm::value_ptr(proj_view));
 
-#ifdef OPENVR_ENABLED
-  OpenVRDisplay vr_display;
-#endif
+  // With single pass stereo or late latching the eyes' and mirror window's
+  // matrices are in a uniform buffer instead, the eyes are updated each
+  // frame right before they're drawn
+  GLuint viewsUbo = 0;
+  const GLint first_view_unif = glGetUniformLocation(shader, "first_view");
+  if (singlePassStereo || lateLatch) {
+    glGenBuffers(1, &viewsUbo);
+    glBindBuffer(GL_UNIFORM_BUFFER, viewsUbo);
+    glBufferData(GL_UNIFORM_BUFFER, 3 * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), sizeof(glm::mat4),
+        glm::value_ptr(proj_view));
+    glUniformBlockBinding(shader, glGetUniformBlockIndex(shader, "Views"), 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, viewsUbo);
+  }
 
-  bool quit = false;
+  std::atomic<bool> quit(false);
+  const std::array<uint32_t, 2> eyeSize = vr_display ? vr_display->render_dims
+    : std::array<uint32_t, 2>{2048, 2048};
+  if (benchmarkEnvmap) {
+    benchmark_envmap_lookups(vao, eyeSize[0], eyeSize[1]);
+    quit = true;
+  }
+  if (benchmarkSky) {
+    benchmark_sky_draws(vao, eyeSize[0], eyeSize[1]);
+    quit = true;
+  }
   bool interactiveCamera = false;
   bool interacting = false;
   sg::TimeStamp lastRenderTime;
   sg::TimeStamp lastUpdateTime;
   float stepsize = 2.f;
+  // The engine is reading the scene graph on its thread, so edits go
+  // through its queue and are applied and committed between its frames
+  auto queueEdit = [&](const char *name, const std::function<void()> &edit, uint64_t tag) {
+    if (!async_renderer.queue_edit(name, edit, tag)) {
+      std::cout << "Scene edit queue is full, dropped '" << name << "' edit\n";
+      return false;
+    }
+    return true;
+  };
+  auto moveCamera = [&](const ospcommon::vec3f &pos) {
+    queueEdit("camera position", [panoramicCamera, pos]() {
+      panoramicCamera->child("pos").setValue(pos);
+    }, 0);
+  };
+
+  // Upload the latest panorama, draw and submit the eyes and draw the
+  // mirror window. With --vr-thread this runs on its own thread, which
+  // holds the GL context, so event handling on this one can't hold up
+  // WaitGetPoses
+  auto render_frame = [&]() {
+    bool newPanorama = false;
+    if (tile_queue) {
+      glActiveTexture(GL_TEXTURE1);
+      panorama->begin_tiles();
+      // Bound the tiles taken per frame so a burst can't delay the eyes,
+      // the rest are picked up next frame
+      for (size_t i = 0; i < 256; ++i) {
+        const bool popped = tile_queue->pop([&](const StreamedTile &t) {
+          // The first tile of a resized panorama
+          if (t.frame_width != panorama->width || t.frame_height != panorama->height) {
+            panorama->end_tiles();
+            panorama->resize(t.frame_width, t.frame_height);
+            panorama->begin_tiles();
+          }
+          panorama->write_tile(t);
+        });
+        if (!popped) {
+          break;
+        }
+        newPanorama = true;
+      }
+      panorama->end_tiles();
+      glActiveTexture(GL_TEXTURE0);
+    } else if (persistent_ring) {
+      glActiveTexture(GL_TEXTURE1);
+      uint64_t tag = 0;
+      if (persistent_ring->upload_latest(*panorama, &tag)) {
+        show_frame_tag(tag);
+        lastRenderTime = sg::TimeStamp();
+        newPanorama = true;
+      }
+      glActiveTexture(GL_TEXTURE0);
+    } else if (uploader) {
+      // The uploader has already transferred the panorama, we just switch
+      // to its texture
+      uint64_t tag = 0;
+      PanoramaTexture *latest = uploader->acquire(tag);
+      if (latest) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(latest->target, latest->texture);
+        glActiveTexture(GL_TEXTURE0);
+        shownPanorama = latest;
+        show_frame_tag(tag);
+        lastRenderTime = sg::TimeStamp();
+        newPanorama = true;
+      }
+    } else if (async_renderer.has_new_frame()) {
+      auto &mappedFB = async_renderer.map_framebuffer();
+      const vec2i frameSize = async_renderer.frame_size();
+      glActiveTexture(GL_TEXTURE1);
+      panorama->resize(frameSize.x, frameSize.y);
+      panorama->upload(mappedFB.data(), async_renderer.dirty_tiles());
+      show_frame_tag(async_renderer.frame_tag());
+      async_renderer.unmap_framebuffer();
+      glActiveTexture(GL_TEXTURE0);
+      lastRenderTime = sg::TimeStamp();
+      newPanorama = true;
+    }
+    if (cubeConverter && newPanorama) {
+      glActiveTexture(GL_TEXTURE1);
+      cubeConverter->convert(*shownPanorama);
+      // The cube map is recreated when the panorama is resized
+      glActiveTexture(GL_TEXTURE3);
+      glBindTexture(GL_TEXTURE_CUBE_MAP, cubeConverter->cube_map);
+      glActiveTexture(GL_TEXTURE0);
+    }
+
+    if (vr_display) {
+      vr_display->begin_frame();
+      if (framePacer) {
+        framePacer->poses_ready(vr_display->wait_ms, vr_display->dropped_frame);
+      }
+      if (poseRecording.is_open()) {
+        const std::chrono::duration<double> time = std::chrono::steady_clock::now() - recordingStart;
+        PoseTrace::append_pose(poseRecording, time.count(),
+            glm::inverse(vr_display->hmd_mats.absolute_to_device));
+      }
+    }
+    if (vr_display && foveated) {
+      // The HMD looks down its -Z axis
+      const glm::vec3 gaze = -glm::vec3(glm::inverse(vr_display->hmd_mats.absolute_to_device)[2]);
+      if (glm::dot(glm::normalize(gaze), renderGaze) < FOVEATION_RECENTER_COS) {
+        // If the edit's dropped the gaze is still off center next frame
+        // and we try again
+        const glm::vec3 newGaze = glm::normalize(gaze);
+        const ospcommon::vec3f gazeDir{newGaze.x, newGaze.y, newGaze.z};
+        if (queueEdit("gaze", [panoramicCamera, gazeDir]() {
+              panoramicCamera->child("gazeDir").setValue(gazeDir);
+            }, gazeTag + 1))
+        {
+          renderGaze = newGaze;
+          pendingGazes.push_back(std::make_pair(++gazeTag, renderGaze));
+          projection.gaze_frame = gaze_frame(renderGaze);
+        }
+      }
+    }
+
+    if (viewPriority) {
+      // Regions are found in the panorama as it's currently sized
+      if (projection.width != shownPanorama->width
+          || projection.height != shownPanorama->height)
+      {
+        projection.width = shownPanorama->width;
+        projection.height = shownPanorama->height;
+        viewRegions.clear();
+      }
+      std::vector<glm::mat4> eyeProjViews;
+      if (vr_display) {
+        // WaitGetPoses gives us the pose predicted for when this frame is
+        // displayed, so this is the view the panorama should converge for
+        const std::array<glm::mat4, 2> projViews = vr_display->eye_proj_views();
+        eyeProjViews.assign(projViews.begin(), projViews.end());
+      } else {
+        eyeProjViews.push_back(proj_view);
+      }
+      find_view_regions(projection, eyeProjViews, 64, 0, seenRegions);
+      if (viewRegions.empty() || !regions_contain(viewRegions, seenRegions)) {
+        find_view_regions(projection, eyeProjViews, 64, 1, viewRegions);
+        async_renderer.set_view_regions(viewRegions);
+      }
+    }
+
+    if (vr_display) {
+      if (hiddenArea) {
+        // Test against the masks without overwriting them
+        glDepthMask(GL_FALSE);
+      }
+      if (singlePassStereo) {
+        vr_display->begin_stereo();
+        glClear(eyeClearBits);
+      }
+      // The pose from WaitGetPoses is already old by the time we get here
+      // after polling events and uploading the panorama, so predict it
+      // again and write the matrices just before drawing
+      if (lateLatch) {
+        vr_display->latch_pose();
+      }
+      const std::array<glm::mat4, 2> projViews = vr_display->eye_proj_views();
+      if (singlePassStereo) {
+        glBindBuffer(GL_UNIFORM_BUFFER, viewsUbo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(projViews), projViews.data());
+        glUniform1i(first_view_unif, 0);
+        vr_display->record_pose_age();
+        glDrawArraysInstanced(skyPrimitive, 0, skyVertices, 2);
+      } else {
+        for (size_t i = 0; i < 2; ++i) {
+          vr_display->begin_eye(i);
+          // The panorama covers every pixel, so lean targets skip the clear,
+          // which for the side by side texture would also wipe the left eye
+          if (!leanEyeTargets) {
+            glClear(eyeClearBits);
+          }
+
+          if (viewsUbo) {
+            glBindBuffer(GL_UNIFORM_BUFFER, viewsUbo);
+            glBufferSubData(GL_UNIFORM_BUFFER, i * sizeof(glm::mat4), sizeof(glm::mat4),
+                glm::value_ptr(projViews[i]));
+            glUniform1i(first_view_unif, i);
+          } else {
+            glUniformMatrix4fv(proj_view_unif, 1, GL_FALSE, glm::value_ptr(projViews[i]));
+          }
+          vr_display->record_pose_age();
+          glDrawArrays(skyPrimitive, 0, skyVertices);
+        }
+      }
+      // The mirror follows the headset through the right eye's view, as it
+      // does through the proj_view uniform left by the eyes without the UBO
+      if (viewsUbo) {
+        glBindBuffer(GL_UNIFORM_BUFFER, viewsUbo);
+        glBufferSubData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), sizeof(glm::mat4),
+            glm::value_ptr(projViews[1]));
+      }
+      if (hiddenArea) {
+        glDepthMask(GL_TRUE);
+      }
+      vr_display->submit();
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, MIRROR_WIDTH, MIRROR_HEIGHT);
+    glClear(mirrorClearBits);
+    if (hiddenArea && !vr_display) {
+      hiddenArea->draw(0);
+    }
+    if (viewsUbo) {
+      glUniform1i(first_view_unif, 2);
+    }
+    if (singlePassStereo) {
+      glDrawArraysInstanced(skyPrimitive, 0, skyVertices, 1);
+    } else {
+      glDrawArrays(skyPrimitive, 0, skyVertices);
+    }
+    SDL_GL_SwapWindow(window);
+  };
+  std::thread vrThread;
+  if (vrRenderThread && !quit) {
+    SDL_GL_MakeCurrent(window, nullptr);
+    vrThread = std::thread([&]() {
+      SDL_GL_MakeCurrent(window, ctx);
+      while (!quit) {
+        if (framePacer) {
+          framePacer->wait_for_start();
+        }
+        render_frame();
+      }
+      SDL_GL_MakeCurrent(window, nullptr);
+    });
+  }
   while (!quit) {
+    // Without the VR thread the running start is also when this loop polls
+    // events, so the input is fresh for the next poses
+    if (framePacer && !vrThread.joinable()) {
+      framePacer->wait_for_start();
+    }
+    if (vrThread.joinable()) {
+      // Nothing else to do here, so sleep until there's an event
+      SDL_WaitEventTimeout(nullptr, 10);
+    } else if (!vr_display && !tile_queue) {
+      // With just the mirror window to draw there's nothing to redraw
+      // until the engine has a new frame or there's input
+      SDL_WaitEventTimeout(nullptr, 100);
+    }
     SDL_Event e;
     bool moved = false;
     while (SDL_PollEvent(&e)) {
@@ -379,16 +1524,24 @@ int main(int argc, const char **argv) {
       } else if (e.type == SDL_KEYDOWN) {
 		  switch (e.key.keysym.sym) {
 			  case SDLK_1:
-				  panoramicCamera->child("pos").setValue(ospcommon::vec3f{21, 200, -49});
+				  moveCamera(ospcommon::vec3f{21, 200, -49});
 				  break;
 			  case SDLK_2:
-				  panoramicCamera->child("pos").setValue(ospcommon::vec3f{800, 200, -49});
+				  moveCamera(ospcommon::vec3f{800, 200, -49});
 				  break;
 			  case SDLK_3:
-				  panoramicCamera->child("pos").setValue(ospcommon::vec3f{-1200, 200, -45});
+				  moveCamera(ospcommon::vec3f{-1200, 200, -45});
 				  break;
 			  case SDLK_4:
-				  panoramicCamera->child("pos").setValue(ospcommon::vec3f{-720, 600, 180});
+				  moveCamera(ospcommon::vec3f{-720, 600, 180});
+				  break;
+			  case SDLK_t:
+				  if (vr_display) {
+					  const std::string file = frameTimingFile.empty() ? "osp360-frame-timing.csv"
+						  : frameTimingFile;
+					  write_frame_timings(file, vr_display->frame_timings.snapshot());
+					  std::cout << "Wrote frame timings to " << file << "\n";
+				  }
 				  break;
 			  default: break;
 		  }
@@ -421,56 +1574,88 @@ int main(int argc, const char **argv) {
         break;
       }
 	  */
+      else if (e.type == newFrameEvent) {
+        newFrameEventPending = false;
+      }
       else if (e.type == SDL_KEYUP) {
         interacting = false;
       }
     }
     if (!moved && interactiveCamera && !interacting)
     {
-      renderer.setChild("camera", panoramicCamera);
-      panoramicCamera->markAsModified();
-      panoramicCamera->setChildrenModified(sg::TimeStamp());
-      interactiveCamera = false;
-    }
-    if (async_renderer.hasNewFrame()) {
-      auto &mappedFB = async_renderer.mapFramebuffer();
-      auto fbData = mappedFB.data();
-      glActiveTexture(GL_TEXTURE1);
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, PANORAMIC_WIDTH, PANORAMIC_HEIGHT, 0,
-          GL_RGBA, GL_UNSIGNED_BYTE, fbData);
-      async_renderer.unmapFramebuffer();
-      glActiveTexture(GL_TEXTURE0);
-      lastRenderTime = sg::TimeStamp();
+      // Try again next time through if the edit's dropped
+      interactiveCamera = !queueEdit("camera", [&renderer, panoramicCamera]() {
+        renderer.setChild("camera", panoramicCamera);
+        panoramicCamera->markAsModified();
+        panoramicCamera->setChildrenModified(sg::TimeStamp());
+      }, 0);
     }
-
-#ifdef OPENVR_ENABLED
-    vr_display.begin_frame();
-    for (size_t i = 0; i < 2; ++i) {
-      glm::mat4 proj, view;
-      vr_display.begin_eye(i, view, proj);
-      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-      // Remove translation from the view matrix
-      view[3] = glm::vec4(0, 0, 0, 1);
-      glm::mat4 proj_view = proj * view;
-      glUniformMatrix4fv(proj_view_unif, 1, GL_FALSE, glm::value_ptr(proj_view));
-
-      glDrawArrays(GL_TRIANGLE_STRIP, 0, CUBE_STRIP.size() / 3);
+    if (!vrThread.joinable()) {
+      render_frame();
     }
-    vr_display.submit();
-#endif
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, MIRROR_WIDTH, MIRROR_HEIGHT);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, CUBE_STRIP.size() / 3);
-    SDL_GL_SwapWindow(window);
+  }
+  if (vrThread.joinable()) {
+    vrThread.join();
+    SDL_GL_MakeCurrent(window, ctx);
   }
 
+  // Stop the engine first, it wakes the uploader
   async_renderer.stop();
+  uploader = nullptr;
+  if (uploadCtx) {
+    SDL_GL_DeleteContext(uploadCtx);
+  }
+  if (uploadWindow) {
+    SDL_DestroyWindow(uploadWindow);
+  }
+
+  if (vr_display) {
+    std::cout << "Pose age at draw: " << vr_display->average_pose_age_ms() << "ms average, "
+      << vr_display->pose_age_max_ms << "ms max\n";
+    const std::vector<FrameTiming> timings = vr_display->frame_timings.snapshot();
+    const FrameTimingSummary summary(timings);
+    std::cout << "Compositor over the last " << summary.frames << " frames: "
+      << summary.dropped << " dropped, " << summary.reprojected << " reprojected, "
+      << summary.mispresented << " mispresented, GPU " << summary.average_gpu_ms
+      << "ms average " << summary.max_gpu_ms << "ms max, waiting for poses "
+      << summary.average_cpu_wait_ms << "ms average\n";
+    if (!frameTimingFile.empty()) {
+      write_frame_timings(frameTimingFile, timings);
+    }
+  }
+  for (const auto &e : async_renderer.edit_stats()) {
+    std::cout << "Scene edit '" << e.first << "': " << e.second.count << " applied, "
+      << e.second.average_ms() << "ms average, " << e.second.max_ms << "ms max\n";
+  }
+  if (framePacer) {
+    std::cout << "Running start settled " << framePacer->lead_ms << "ms before the poses\n";
+  }
+  if (mockBackend) {
+    std::cout << "Mock VR: " << mockBackend->frames << " frames, "
+      << mockBackend->missed_vsyncs << " missed vsyncs at " << mockRefreshRate << "Hz\n";
+    for (size_t i = 0; i < 2 && !mockCapturePrefix.empty(); ++i) {
+      if (mockBackend->captures[i].empty()) {
+        continue;
+      }
+      // Like OSPRay's framebuffers the captures are bottom up, which
+      // writePPM expects
+      const std::string file = mockCapturePrefix + (i == 0 ? "-left.ppm" : "-right.ppm");
+      ospcommon::utility::writePPM(file, mockBackend->eye_size[0], mockBackend->eye_size[1],
+          reinterpret_cast<const uint32_t*>(mockBackend->captures[i].data()));
+    }
+  }
 
   glDeleteProgram(shader);
-  glDeleteTextures(1, &tex);
+  cubeConverter = nullptr;
+  hiddenArea = nullptr;
+  if (uvLut) {
+    glDeleteTextures(1, &uvLut);
+  }
+  if (viewsUbo) {
+    glDeleteBuffers(1, &viewsUbo);
+  }
+  persistent_ring = nullptr;
+  panorama = nullptr;
   glDeleteBuffers(1, &vbo);
   glDeleteVertexArrays(1, &vao);
 
@@ -498,12 +1683,19 @@ GLuint compile_shader(const std::string &src, GLenum type) {
   }
   return shader;
 }
-GLuint load_shader_program(const std::string &vshader_src, const std::string &fshader_src) {
+GLuint load_shader_program(const std::string &vshader_src, const std::string &fshader_src,
+    const std::string &gshader_src)
+{
   GLuint vs = compile_shader(vshader_src, GL_VERTEX_SHADER);
   GLuint fs = compile_shader(fshader_src, GL_FRAGMENT_SHADER);
+  GLuint gs = 0;
   GLuint prog = glCreateProgram();
   glAttachShader(prog, vs);
   glAttachShader(prog, fs);
+  if (!gshader_src.empty()) {
+    gs = compile_shader(gshader_src, GL_GEOMETRY_SHADER);
+    glAttachShader(prog, gs);
+  }
   glLinkProgram(prog);
 
   GLint status;
@@ -521,6 +1713,10 @@ GLuint load_shader_program(const std::string &vshader_src, const std::string &fs
   glDetachShader(prog, fs);
   glDeleteShader(vs);
   glDeleteShader(fs);
+  if (gs) {
+    glDetachShader(prog, gs);
+    glDeleteShader(gs);
+  }
   return prog;
 }
 
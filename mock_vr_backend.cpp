@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <glm/ext.hpp>
+#include "mock_vr_backend.h"
+
+PoseTrace PoseTrace::load(const std::string &path) {
+	std::ifstream fin(path.c_str());
+	if (!fin) {
+		throw std::runtime_error("Failed to open pose trace " + path);
+	}
+	PoseTrace trace;
+	std::string line;
+	while (std::getline(fin, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		std::istringstream in(line);
+		double time = 0.0;
+		glm::mat4 pose(1.f);
+		in >> time;
+		for (int i = 0; i < 3; ++i) {
+			for (int j = 0; j < 4; ++j) {
+				in >> pose[j][i];
+			}
+		}
+		if (!in) {
+			throw std::runtime_error("Invalid pose in trace " + path + ": " + line);
+		}
+		trace.times.push_back(time);
+		trace.poses.push_back(pose);
+	}
+	if (trace.poses.empty()) {
+		throw std::runtime_error("Pose trace " + path + " is empty");
+	}
+	return trace;
+}
+PoseTrace PoseTrace::synthetic(double duration, double rate) {
+	const float PI = 3.14159265358979f;
+	PoseTrace trace;
+	const size_t samples = std::max(static_cast<size_t>(duration * rate), size_t(1));
+	for (size_t i = 0; i < samples; ++i) {
+		const double time = i / rate;
+		const float yaw = 2.f * PI * static_cast<float>(time / 20.0);
+		const float pitch = 0.35f * std::sin(2.f * PI * static_cast<float>(time / 5.0));
+		glm::mat4 pose = glm::translate(glm::mat4(1.f), glm::vec3(0.f, 1.7f, 0.f));
+		pose = glm::rotate(pose, yaw, glm::vec3(0.f, 1.f, 0.f));
+		pose = glm::rotate(pose, pitch, glm::vec3(1.f, 0.f, 0.f));
+		trace.times.push_back(time);
+		trace.poses.push_back(pose);
+	}
+	return trace;
+}
+void PoseTrace::append_pose(std::ostream &os, double time, const glm::mat4 &pose) {
+	os << time;
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			os << " " << pose[j][i];
+		}
+	}
+	os << "\n";
+}
+glm::mat4 PoseTrace::sample(double time) const {
+	if (times.back() > 0.0) {
+		time = std::fmod(time, times.back());
+	}
+	auto next = std::upper_bound(times.begin(), times.end(), time);
+	const size_t i = next == times.begin() ? 0 : std::distance(times.begin(), next) - 1;
+	return poses[i];
+}
+
+MockVRBackend::MockVRBackend(const PoseTrace &trace, float refresh_rate,
+		std::array<uint32_t, 2> eye_size)
+	: trace(trace), refresh_rate(refresh_rate), eye_size(eye_size), last_vsync(0),
+	frames(0), missed_vsyncs(0), last_presents(0), last_wait_ms(0.f), wait_ms(0.f),
+	capture_interval(0)
+{}
+std::array<uint32_t, 2> MockVRBackend::render_target_size() {
+	return eye_size;
+}
+glm::mat4 MockVRBackend::projection(size_t, float near_plane, float far_plane) {
+	// Roughly the field of view of current headsets
+	return glm::perspective(glm::radians(110.f),
+			static_cast<float>(eye_size[0]) / eye_size[1], near_plane, far_plane);
+}
+glm::mat4 MockVRBackend::eye_to_head(size_t eye) {
+	// A typical 64mm IPD
+	const float offset = eye == 0 ? -0.032f : 0.032f;
+	return glm::translate(glm::mat4(1.f), glm::vec3(offset, 0.f, 0.f));
+}
+HiddenAreaMesh MockVRBackend::hidden_area_mesh(size_t) {
+	return synthetic_hidden_area_mesh();
+}
+float MockVRBackend::vsync_period() {
+	return 1.f / refresh_rate;
+}
+glm::mat4 MockVRBackend::wait_get_poses() {
+	using namespace std::chrono;
+	const steady_clock::time_point now = steady_clock::now();
+	if (frames == 0) {
+		start = now;
+	}
+	const double period = 1.0 / refresh_rate;
+	const uint64_t vsync = static_cast<uint64_t>(duration<double>(now - start).count() / period) + 1;
+	std::this_thread::sleep_until(start
+			+ duration_cast<steady_clock::duration>(duration<double>(vsync * period)));
+	last_wait_ms = wait_ms;
+	wait_ms = duration<float, std::milli>(steady_clock::now() - now).count();
+	if (frames > 0) {
+		// The previous frame stays up until this one's shown
+		last_presents = vsync - last_vsync;
+		missed_vsyncs += last_presents - 1;
+	}
+	last_vsync = vsync;
+	++frames;
+	return predict_pose();
+}
+glm::mat4 MockVRBackend::predict_pose() {
+	return trace.sample((last_vsync + 1) / refresh_rate);
+}
+bool MockVRBackend::frame_timing(FrameTiming &timing) {
+	if (last_presents == 0) {
+		return false;
+	}
+	const double period = 1.0 / refresh_rate;
+	timing.frame_index = frames - 2;
+	timing.system_time = (last_vsync - last_presents) * period;
+	timing.cpu_wait_ms = last_wait_ms;
+	timing.frame_interval_ms = last_presents * period * 1000.0;
+	timing.presents = last_presents;
+	timing.dropped = last_presents - 1;
+	// Like OpenVR's interleaved reprojection, showing a frame again
+	// without a new one counts as reprojecting it
+	timing.reprojection_flags = last_presents > 1 ? 1 : 0;
+	return true;
+}
+void MockVRBackend::submit(size_t eye, GLuint texture, bool array_texture,
+		const glm::vec4 &bounds, const glm::mat4&)
+{
+	if (capture_interval == 0 || (frames - 1) % capture_interval != 0) {
+		return;
+	}
+	const GLenum target = array_texture ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+	GLint prev_texture = 0;
+	glGetIntegerv(array_texture ? GL_TEXTURE_BINDING_2D_ARRAY : GL_TEXTURE_BINDING_2D,
+			&prev_texture);
+	glBindTexture(target, texture);
+	GLint width = 0, height = 0, layers = 1;
+	glGetTexLevelParameteriv(target, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(target, 0, GL_TEXTURE_HEIGHT, &height);
+	if (array_texture) {
+		glGetTexLevelParameteriv(target, 0, GL_TEXTURE_DEPTH, &layers);
+	}
+	std::vector<uint8_t> pixels(size_t(width) * height * layers * 4);
+	glGetTexImage(target, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	glBindTexture(target, prev_texture);
+
+	// Copy out the eye's region
+	const size_t layer = array_texture ? eye : 0;
+	const size_t x0 = bounds.x * width;
+	const size_t y0 = bounds.y * height;
+	const size_t eye_width = (bounds.z - bounds.x) * width;
+	const size_t eye_height = (bounds.w - bounds.y) * height;
+	std::vector<uint8_t> &capture = captures[eye];
+	capture.resize(eye_width * eye_height * 4);
+	for (size_t y = 0; y < eye_height; ++y) {
+		const uint8_t *row = &pixels[((layer * height + y0 + y) * width + x0) * 4];
+		std::copy(row, row + eye_width * 4, &capture[y * eye_width * 4]);
+	}
+}
+
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "vr_backend.h"
+
+// A recorded or scripted HMD motion, as the HMD's transforms to absolute
+// tracking space over time
+struct PoseTrace {
+	std::vector<double> times;
+	std::vector<glm::mat4> poses;
+
+	// Load a trace written with append_pose, e.g. by --record-poses
+	static PoseTrace load(const std::string &path);
+	// A scripted motion sampled at rate Hz: the head turns a full circle
+	// over 20 seconds while nodding up and down every 5
+	static PoseTrace synthetic(double duration, double rate);
+	// Write a pose as a line of a trace: the time in seconds followed by
+	// the 3x4 transform in row major order, like OpenVR's HmdMatrix34_t
+	static void append_pose(std::ostream &os, double time, const glm::mat4 &pose);
+	// The last pose at or before the time, looping past the trace's end
+	glm::mat4 sample(double time) const;
+};
+
+// Stands in for a headset without OpenVR, so the VR path can be run and
+// measured reproducibly, e.g. on build machines with a software GL. The
+// HMD follows a pose trace, WaitGetPoses' blocking until the next vsync
+// is emulated at the refresh rate, and submitted eyes can be read back.
+struct MockVRBackend : VRBackend {
+	MockVRBackend(const PoseTrace &trace, float refresh_rate = 90.f,
+			std::array<uint32_t, 2> eye_size = {1512, 1680});
+	std::array<uint32_t, 2> render_target_size() override;
+	glm::mat4 projection(size_t eye, float near_plane, float far_plane) override;
+	glm::mat4 eye_to_head(size_t eye) override;
+	HiddenAreaMesh hidden_area_mesh(size_t eye) override;
+	float vsync_period() override;
+	// Sleeps until the next vsync and returns the trace's pose for when
+	// the frame is displayed, at the vsync after. The trace is sampled at
+	// vsync times, not the wall clock, so the poses seen for each vsync
+	// are the same from run to run
+	glm::mat4 wait_get_poses() override;
+	// The trace is the true motion, so predicting again gives the same
+	// pose as wait_get_poses
+	glm::mat4 predict_pose() override;
+	void submit(size_t eye, GLuint texture, bool array_texture,
+			const glm::vec4 &bounds, const glm::mat4 &pose) override;
+	// The previous frame's vsync timing, there's no GPU time to report
+	bool frame_timing(FrameTiming &timing) override;
+
+	PoseTrace trace;
+	float refresh_rate;
+	std::array<uint32_t, 2> eye_size;
+	std::chrono::steady_clock::time_point start;
+	uint64_t last_vsync;
+	// Frames rendered, and vsyncs that passed without a new frame
+	uint64_t frames, missed_vsyncs;
+	// The vsyncs the previous frame was shown for, and how long it and
+	// this frame waited for them
+	uint64_t last_presents;
+	float last_wait_ms, wait_ms;
+	// Read the submitted eyes back into captures every capture_interval
+	// frames, 0 disables capturing since reading back stalls the GPU
+	uint64_t capture_interval;
+	// RGBA8 images of eye_size, with the first row at the bottom
+	std::array<std::vector<uint8_t>, 2> captures;
+};
+
@@ -0,0 +1,6 @@
+// The OSPRay side of the module, loaded with ospLoadModule("openvr").
+// The pixel ops and cameras it provides register themselves through the
+// OSP_REGISTER_* macros, so there's nothing to set up on load.
+extern "C" void ospray_init_module_openvr() {
+}
+
@@ -0,0 +1,130 @@
+#ifdef OPENVR_ENABLED
+
+#include <stdexcept>
+#include "openvr_backend.h"
+
+// Convert an OpenVR HmdMatrix44_t to a glm::mat4
+glm::mat4 hmd44_to_mat4(const vr::HmdMatrix44_t &m) {
+	return glm::mat4(
+			m.m[0][0], m.m[1][0], m.m[2][0], m.m[3][0],
+			m.m[0][1], m.m[1][1], m.m[2][1], m.m[3][1],
+			m.m[0][2], m.m[1][2], m.m[2][2], m.m[3][2],
+			m.m[0][3], m.m[1][3], m.m[2][3], m.m[3][3]);
+}
+glm::mat4 hmd34_to_mat4(const vr::HmdMatrix34_t &m) {
+	return glm::mat4(
+			m.m[0][0], m.m[1][0], m.m[2][0], 0.f,
+			m.m[0][1], m.m[1][1], m.m[2][1], 0.f,
+			m.m[0][2], m.m[1][2], m.m[2][2], 0.f,
+			m.m[0][3], m.m[1][3], m.m[2][3], 1.f);
+}
+
+OpenVRBackend::OpenVRBackend() {
+	vr::EVRInitError vr_error;
+	system = vr::VR_Init(&vr_error, vr::VRApplication_Scene);
+	if (vr_error != vr::VRInitError_None) {
+		throw std::runtime_error("Failed to init OpenVR");
+	}
+	if (!system->IsTrackedDeviceConnected(vr::k_unTrackedDeviceIndex_Hmd)) {
+		throw std::runtime_error("HMD is not tracking, check connection");
+	}
+	compositor = vr::VRCompositor();
+	if (!compositor) {
+		throw std::runtime_error("Failed to init VR Compositor");
+	}
+	frame_duration = 1.f / system->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd,
+			vr::Prop_DisplayFrequency_Float);
+	vsync_to_photons = system->GetFloatTrackedDeviceProperty(vr::k_unTrackedDeviceIndex_Hmd,
+			vr::Prop_SecondsFromVsyncToPhotons_Float);
+}
+OpenVRBackend::~OpenVRBackend() {
+	vr::VR_Shutdown();
+}
+std::array<uint32_t, 2> OpenVRBackend::render_target_size() {
+	std::array<uint32_t, 2> size;
+	system->GetRecommendedRenderTargetSize(&size[0], &size[1]);
+	return size;
+}
+glm::mat4 OpenVRBackend::projection(size_t eye, float near_plane, float far_plane) {
+	return hmd44_to_mat4(system->GetProjectionMatrix(static_cast<vr::EVREye>(eye),
+				near_plane, far_plane));
+}
+glm::mat4 OpenVRBackend::eye_to_head(size_t eye) {
+	return hmd34_to_mat4(system->GetEyeToHeadTransform(static_cast<vr::EVREye>(eye)));
+}
+HiddenAreaMesh OpenVRBackend::hidden_area_mesh(size_t eye) {
+	const vr::HiddenAreaMesh_t mesh = system->GetHiddenAreaMesh(static_cast<vr::EVREye>(eye),
+			vr::k_eHiddenAreaMesh_Standard);
+	HiddenAreaMesh verts;
+	for (uint32_t v = 0; v < 3 * mesh.unTriangleCount; ++v) {
+		verts.push_back(glm::vec2(mesh.pVertexData[v].v[0], mesh.pVertexData[v].v[1]));
+	}
+	return verts;
+}
+float OpenVRBackend::vsync_period() {
+	return frame_duration;
+}
+glm::mat4 OpenVRBackend::wait_get_poses() {
+	compositor->WaitGetPoses(tracked_devices.data(), tracked_devices.size(), NULL, 0);
+	return hmd34_to_mat4(tracked_devices[vr::k_unTrackedDeviceIndex_Hmd].mDeviceToAbsoluteTracking);
+}
+glm::mat4 OpenVRBackend::predict_pose() {
+	// The frame is shown at the next vsync and lit up vsync to photons
+	// after it, see IVRSystem::GetDeviceToAbsoluteTrackingPose
+	float since_vsync = 0.f;
+	system->GetTimeSinceLastVsync(&since_vsync, NULL);
+	const float seconds_to_photons = frame_duration - since_vsync + vsync_to_photons;
+
+	vr::TrackedDevicePose_t hmd;
+	system->GetDeviceToAbsoluteTrackingPose(compositor->GetTrackingSpace(), seconds_to_photons,
+			&hmd, 1);
+	if (!hmd.bPoseIsValid) {
+		return hmd34_to_mat4(tracked_devices[vr::k_unTrackedDeviceIndex_Hmd].mDeviceToAbsoluteTracking);
+	}
+	return hmd34_to_mat4(hmd.mDeviceToAbsoluteTracking);
+}
+void OpenVRBackend::submit(size_t eye, GLuint texture, bool array_texture,
+		const glm::vec4 &bounds, const glm::mat4 &pose)
+{
+	// Tell the compositor the pose we rendered with, which may be newer
+	// than the one WaitGetPoses gave, so it reprojects from the right one
+	vr::VRTextureWithPose_t tex = {};
+	tex.handle = (void*)static_cast<uintptr_t>(texture);
+	tex.eType = vr::TextureType_OpenGL;
+	tex.eColorSpace = vr::ColorSpace_Gamma;
+	for (int i = 0; i < 3; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			tex.mDeviceToAbsoluteTracking.m[i][j] = pose[j][i];
+		}
+	}
+	const vr::VRTextureBounds_t vr_bounds = {bounds.x, bounds.y, bounds.z, bounds.w};
+	// The compositor reads each eye from the layer of an array texture
+	// matching its index
+	const int flags = vr::Submit_TextureWithPose
+		| (array_texture ? vr::Submit_GlArrayTexture : vr::Submit_Default);
+	compositor->Submit(static_cast<vr::EVREye>(eye), &tex, &vr_bounds,
+			static_cast<vr::EVRSubmitFlags>(flags));
+}
+bool OpenVRBackend::frame_timing(FrameTiming &timing) {
+	vr::Compositor_FrameTiming t = {};
+	t.m_nSize = sizeof(vr::Compositor_FrameTiming);
+	// Frame 0 is the one the compositor is working on now, whose timings
+	// and counts aren't final until it's done
+	if (!compositor->GetFrameTiming(&t, 1)) {
+		return false;
+	}
+	timing.frame_index = t.m_nFrameIndex;
+	timing.system_time = t.m_flSystemTimeInSeconds;
+	timing.gpu_ms = t.m_flTotalRenderGpuMs;
+	timing.compositor_gpu_ms = t.m_flCompositorRenderGpuMs;
+	timing.cpu_wait_ms = t.m_flNewPosesReadyMs - t.m_flWaitGetPosesCalledMs;
+	timing.frame_interval_ms = t.m_flClientFrameIntervalMs;
+	timing.presents = t.m_nNumFramePresents;
+	timing.mispresented = t.m_nNumMisPresented;
+	timing.dropped = t.m_nNumDroppedFrames;
+	timing.reprojection_flags = t.m_nReprojectionFlags;
+	return true;
+}
+
+#endif
+
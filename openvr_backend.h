@@ -0,0 +1,32 @@
+#pragma once
+
+#ifdef OPENVR_ENABLED
+
+#include <array>
+#include <openvr.h>
+#include "vr_backend.h"
+
+// Renders to the HMD connected through OpenVR
+struct OpenVRBackend : VRBackend {
+	OpenVRBackend();
+	~OpenVRBackend();
+	std::array<uint32_t, 2> render_target_size() override;
+	glm::mat4 projection(size_t eye, float near_plane, float far_plane) override;
+	glm::mat4 eye_to_head(size_t eye) override;
+	HiddenAreaMesh hidden_area_mesh(size_t eye) override;
+	float vsync_period() override;
+	glm::mat4 wait_get_poses() override;
+	glm::mat4 predict_pose() override;
+	void submit(size_t eye, GLuint texture, bool array_texture,
+			const glm::vec4 &bounds, const glm::mat4 &pose) override;
+	bool frame_timing(FrameTiming &timing) override;
+
+	vr::IVRSystem *system;
+	vr::IVRCompositor *compositor;
+	std::array<vr::TrackedDevicePose_t, vr::k_unMaxTrackedDeviceCount> tracked_devices;
+	float frame_duration;
+	float vsync_to_photons;
+};
+
+#endif
+
@@ -1,5 +1,5 @@
-#ifdef OPENVR_ENABLED
-
+#include <algorithm>
+#include <stdexcept>
 #include "openvr_display.h"
 
 GLFramebuffer::GLFramebuffer() {
@@ -20,100 +20,205 @@ void GLFramebuffer::attach2d(GLenum attachment, GLuint texture) {
 		throw std::runtime_error("Framebuffer is incomplete!");
 	}
 }
+void GLFramebuffer::attach_layers(GLenum attachment, GLuint texture) {
+	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+	glFramebufferTexture(GL_FRAMEBUFFER, attachment, texture, 0);
+	attachments[attachment] = texture;
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		throw std::runtime_error("Framebuffer is incomplete!");
+	}
+}
 void GLFramebuffer::detach2d(GLenum attachment) {
 	glBindFramebuffer(GL_FRAMEBUFFER, fb);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, 0, 0);
 	attachments.erase(attachment);
 }
 
-// Convert an OpenVR HmdMatrix44_t to a glm::mat4
-glm::mat4 hmd44_to_mat4(const vr::HmdMatrix44_t &m) {
-	return glm::mat4(
-			m.m[0][0], m.m[1][0], m.m[2][0], m.m[3][0],
-			m.m[0][1], m.m[1][1], m.m[2][1], m.m[3][1],
-			m.m[0][2], m.m[1][2], m.m[2][2], m.m[3][2],
-			m.m[0][3], m.m[1][3], m.m[2][3], m.m[3][3]);
-}
-glm::mat4 hmd34_to_mat4(const vr::HmdMatrix34_t &m) {
-	return glm::mat4(
-			m.m[0][0], m.m[1][0], m.m[2][0], 0.f,
-			m.m[0][1], m.m[1][1], m.m[2][1], 0.f,
-			m.m[0][2], m.m[1][2], m.m[2][2], 0.f,
-			m.m[0][3], m.m[1][3], m.m[2][3], 1.f);
+// Allocate a 2D or 2D array eye texture, the layer count is ignored for 2D
+static GLuint make_eye_texture(GLenum target, GLenum format, GLsizei width, GLsizei height,
+		GLsizei layers)
+{
+	const bool depth = format == GL_DEPTH_COMPONENT32F;
+	GLuint tex;
+	glGenTextures(1, &tex);
+	glBindTexture(target, tex);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	const GLenum pixel_format = depth ? GL_DEPTH_COMPONENT : GL_RGBA;
+	const GLenum pixel_type = depth ? GL_FLOAT : GL_UNSIGNED_BYTE;
+	if (target == GL_TEXTURE_2D_ARRAY) {
+		glTexImage3D(target, 0, format, width, height, layers, 0, pixel_format, pixel_type, nullptr);
+	} else {
+		glTexImage2D(target, 0, format, width, height, 0, pixel_format, pixel_type, nullptr);
+	}
+	return tex;
 }
 
-OpenVRDisplay::OpenVRDisplay() {
-	vr::EVRInitError vr_error;
-	system = vr::VR_Init(&vr_error, vr::VRApplication_Scene);
-	if (vr_error != vr::VRInitError_None) {
-		throw std::runtime_error("Failed to init OpenVR");
+OpenVRDisplay::OpenVRDisplay(std::unique_ptr<VRBackend> vr_backend, EyeLayout layout, bool depth)
+	: backend(std::move(vr_backend)), layout(layout), depth(depth), wait_ms(0.f),
+	dropped_frame(false), pose_age_total_ms(0.0),
+	pose_age_max_ms(0.0), pose_age_samples(0), frame_timings(4096),
+	last_frame_timing_index(0)
+{
+	render_dims = backend->render_target_size();
+
+	// OSPRay is already doing sRGB correction, so don't do it twice.
+	switch (layout) {
+		case EyeLayout::SEPARATE:
+			for (auto &eye : eye_fbs) {
+				eye.render.attach2d(GL_COLOR_ATTACHMENT0, make_eye_texture(GL_TEXTURE_2D, GL_RGBA8,
+							render_dims[0], render_dims[1], 1));
+				if (depth) {
+					eye.render.attach2d(GL_DEPTH_ATTACHMENT, make_eye_texture(GL_TEXTURE_2D,
+								GL_DEPTH_COMPONENT32F, render_dims[0], render_dims[1], 1));
+				}
+			}
+			break;
+		case EyeLayout::SIDE_BY_SIDE:
+			stereo_fb.attach2d(GL_COLOR_ATTACHMENT0, make_eye_texture(GL_TEXTURE_2D, GL_RGBA8,
+						2 * render_dims[0], render_dims[1], 1));
+			if (depth) {
+				stereo_fb.attach2d(GL_DEPTH_ATTACHMENT, make_eye_texture(GL_TEXTURE_2D,
+							GL_DEPTH_COMPONENT32F, 2 * render_dims[0], render_dims[1], 1));
+			}
+			break;
+		case EyeLayout::LAYERED:
+			stereo_fb.attach_layers(GL_COLOR_ATTACHMENT0, make_eye_texture(GL_TEXTURE_2D_ARRAY,
+						GL_RGBA8, render_dims[0], render_dims[1], 2));
+			if (depth) {
+				stereo_fb.attach_layers(GL_DEPTH_ATTACHMENT, make_eye_texture(GL_TEXTURE_2D_ARRAY,
+							GL_DEPTH_COMPONENT32F, render_dims[0], render_dims[1], 2));
+			}
+			break;
 	}
-	if (!system->IsTrackedDeviceConnected(vr::k_unTrackedDeviceIndex_Hmd)) {
-		throw std::runtime_error("HMD is not tracking, check connection");
+	for (size_t i = 0; i < 2; ++i) {
+		hmd_mats.projection_eyes[i] = backend->projection(i, 0.01f, 10.f);
+		hmd_mats.head_to_eyes[i] = glm::inverse(backend->eye_to_head(i));
 	}
-	compositor = vr::VRCompositor();
-	if (!compositor) {
-		throw std::runtime_error("Failed to init VR Compositor");
-	}	
-	system->GetRecommendedRenderTargetSize(&render_dims[0], &render_dims[1]);
-
-	for (auto &eye : eye_fbs) {
-		std::array<GLuint, 2> texs;
-		glGenTextures(texs.size(), texs.data());
-		for (auto &t : texs) {
-			glBindTexture(GL_TEXTURE_2D, t);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-		}
-		glBindTexture(GL_TEXTURE_2D, texs[0]);
-		// OSPRay is already doing sRGB correction, so don't do it twice.
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, render_dims[0], render_dims[1],
-				0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-		glBindTexture(GL_TEXTURE_2D, texs[1]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, render_dims[0], render_dims[1],
-				0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+}
+void OpenVRDisplay::begin_frame() {
+	using namespace std::chrono;
+	const steady_clock::time_point start = steady_clock::now();
+	hmd_mats.absolute_to_device = glm::inverse(backend->wait_get_poses());
+	pose_time = steady_clock::now();
+	wait_ms = duration<float, std::milli>(pose_time - start).count();
 
-		eye.render.attach2d(GL_COLOR_ATTACHMENT0, texs[0]);
-		eye.render.attach2d(GL_DEPTH_ATTACHMENT, texs[1]);
+	// If the compositor hasn't moved on to a new frame since we last asked,
+	// the last finished one is the same as before and was already recorded
+	FrameTiming timing;
+	dropped_frame = false;
+	if (backend->frame_timing(timing) && (frame_timings.size() == 0
+				|| timing.frame_index != last_frame_timing_index))
+	{
+		frame_timings.push(timing);
+		last_frame_timing_index = timing.frame_index;
+		dropped_frame = timing.dropped > 0;
 	}
-	hmd_mats.projection_eyes[0] = hmd44_to_mat4(system->GetProjectionMatrix(vr::Eye_Left, 0.01f, 10.f));
-	hmd_mats.projection_eyes[1] = hmd44_to_mat4(system->GetProjectionMatrix(vr::Eye_Right, 0.01f, 10.f));
-
-	hmd_mats.head_to_eyes[0] = glm::inverse(hmd34_to_mat4(system->GetEyeToHeadTransform(vr::Eye_Left)));
-	hmd_mats.head_to_eyes[1] = glm::inverse(hmd34_to_mat4(system->GetEyeToHeadTransform(vr::Eye_Right)));
 }
-OpenVRDisplay::~OpenVRDisplay() {
-	vr::VR_Shutdown();
+void OpenVRDisplay::latch_pose() {
+	hmd_mats.absolute_to_device = glm::inverse(backend->predict_pose());
+	pose_time = std::chrono::steady_clock::now();
 }
-void OpenVRDisplay::begin_frame() {
-	compositor->WaitGetPoses(tracked_devices.data(), tracked_devices.size(), NULL, 0);
-	hmd_mats.absolute_to_device = glm::inverse(hmd34_to_mat4(
-				tracked_devices[vr::k_unTrackedDeviceIndex_Hmd].mDeviceToAbsoluteTracking));
+std::array<glm::mat4, 2> OpenVRDisplay::eye_proj_views() const {
+	std::array<glm::mat4, 2> proj_views;
+	for (size_t i = 0; i < 2; ++i) {
+		glm::mat4 view = hmd_mats.head_to_eyes[i] * hmd_mats.absolute_to_device;
+		view[3] = glm::vec4(0, 0, 0, 1);
+		proj_views[i] = hmd_mats.projection_eyes[i] * view;
+	}
+	return proj_views;
 }
-void OpenVRDisplay::begin_eye(size_t i, glm::mat4 &view, glm::mat4 &proj) {
-	glBindFramebuffer(GL_FRAMEBUFFER, eye_fbs[i].render.fb);
+void OpenVRDisplay::record_pose_age() {
+	const std::chrono::duration<double, std::milli> age = std::chrono::steady_clock::now() - pose_time;
+	pose_age_total_ms += age.count();
+	pose_age_max_ms = std::max(pose_age_max_ms, age.count());
+	++pose_age_samples;
+}
+double OpenVRDisplay::average_pose_age_ms() const {
+	return pose_age_samples > 0 ? pose_age_total_ms / pose_age_samples : 0.0;
+}
+void OpenVRDisplay::begin_eye(size_t i) {
+	if (layout == EyeLayout::SIDE_BY_SIDE) {
+		glBindFramebuffer(GL_FRAMEBUFFER, stereo_fb.fb);
+		glViewport(i * render_dims[0], 0, render_dims[0], render_dims[1]);
+	} else {
+		glBindFramebuffer(GL_FRAMEBUFFER, eye_fbs[i].render.fb);
+		glViewport(0, 0, render_dims[0], render_dims[1]);
+	}
+}
+void OpenVRDisplay::begin_stereo() {
+	glBindFramebuffer(GL_FRAMEBUFFER, stereo_fb.fb);
 	glViewport(0, 0, render_dims[0], render_dims[1]);
-
-	view = hmd_mats.head_to_eyes[i] * hmd_mats.absolute_to_device;
-	proj = hmd_mats.projection_eyes[i];
+}
+HiddenAreaMesh OpenVRDisplay::hidden_area_mesh(size_t i) const {
+	return backend->hidden_area_mesh(i);
+}
+void OpenVRDisplay::mask_hidden_area(HiddenAreaMask &mask) {
+	if (!depth) {
+		throw std::runtime_error("Masking the hidden area needs eye targets with depth");
+	}
+	// The layers of the array texture are masked one at a time through a
+	// depth only framebuffer
+	GLFramebuffer layer_fb;
+	for (size_t i = 0; i < 2; ++i) {
+		switch (layout) {
+			case EyeLayout::SEPARATE:
+				glBindFramebuffer(GL_FRAMEBUFFER, eye_fbs[i].render.fb);
+				glViewport(0, 0, render_dims[0], render_dims[1]);
+				break;
+			case EyeLayout::SIDE_BY_SIDE:
+				glBindFramebuffer(GL_FRAMEBUFFER, stereo_fb.fb);
+				glViewport(i * render_dims[0], 0, render_dims[0], render_dims[1]);
+				break;
+			case EyeLayout::LAYERED:
+				glBindFramebuffer(GL_FRAMEBUFFER, layer_fb.fb);
+				glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+						stereo_fb.attachments[GL_DEPTH_ATTACHMENT], 0, i);
+				glDrawBuffer(GL_NONE);
+				glReadBuffer(GL_NONE);
+				glViewport(0, 0, render_dims[0], render_dims[1]);
+				break;
+		}
+		mask.draw(i);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 void OpenVRDisplay::submit() {
-	vr::Texture_t left_eye = {};
-	left_eye.handle = (void*)eye_fbs[0].render.attachments[GL_COLOR_ATTACHMENT0];
-	left_eye.eType = vr::TextureType_OpenGL;
-	left_eye.eColorSpace = vr::ColorSpace_Gamma;
-
-	vr::Texture_t right_eye = {};
-	right_eye.handle = (void*)eye_fbs[1].render.attachments[GL_COLOR_ATTACHMENT0];
-	right_eye.eType = vr::TextureType_OpenGL;
-	right_eye.eColorSpace = vr::ColorSpace_Gamma;
-
-	compositor->Submit(vr::Eye_Left, &left_eye, NULL, vr::Submit_Default);
-	compositor->Submit(vr::Eye_Right, &right_eye, NULL, vr::Submit_Default);
+	const glm::vec4 full(0.f, 0.f, 1.f, 1.f);
+	const glm::mat4 pose = glm::inverse(hmd_mats.absolute_to_device);
+	switch (layout) {
+		case EyeLayout::SEPARATE:
+			for (size_t i = 0; i < 2; ++i) {
+				backend->submit(i, eye_fbs[i].render.attachments[GL_COLOR_ATTACHMENT0], false, full,
+						pose);
+			}
+			break;
+		case EyeLayout::SIDE_BY_SIDE:
+			backend->submit(0, stereo_fb.attachments[GL_COLOR_ATTACHMENT0], false,
+					glm::vec4(0.f, 0.f, 0.5f, 1.f), pose);
+			backend->submit(1, stereo_fb.attachments[GL_COLOR_ATTACHMENT0], false,
+					glm::vec4(0.5f, 0.f, 1.f, 1.f), pose);
+			break;
+		case EyeLayout::LAYERED:
+			for (size_t i = 0; i < 2; ++i) {
+				backend->submit(i, stereo_fb.attachments[GL_COLOR_ATTACHMENT0], true, full, pose);
+			}
+			break;
+	}
 	glFlush();
 }
-
-#endif
+float OpenVRDisplay::pixels_per_radian() const {
+	// The projection scales the tangent of the angle off the view axis into
+	// NDC, so at the center of view one radian covers proj[0][0] (or
+	// proj[1][1]) half-widths of the eye buffer
+	float density = 0.f;
+	for (const auto &proj : hmd_mats.projection_eyes) {
+		density = std::max(density, std::max(proj[0][0] * render_dims[0],
+					proj[1][1] * render_dims[1]) / 2.f);
+	}
+	return density;
+}
 
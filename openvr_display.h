@@ -1,13 +1,15 @@
 #pragma once
 
-#ifdef OPENVR_ENABLED
-
 #include <array>
+#include <chrono>
+#include <memory>
 #include <unordered_map>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
-#include <openvr.h>
 #include <GL/gl3w.h>
+#include "frame_timing.h"
+#include "hidden_area_mask.h"
+#include "vr_backend.h"
 
 struct GLFramebuffer {
 	GLuint fb;
@@ -17,6 +19,8 @@ struct GLFramebuffer {
 	// Destroys the framebuffer and all attached textures
 	~GLFramebuffer();
 	void attach2d(GLenum attachment, GLuint texture);
+	// Attach all layers of an array texture, for layered rendering
+	void attach_layers(GLenum attachment, GLuint texture);
 	void detach2d(GLenum attachment);
 };
 
@@ -33,25 +37,75 @@ struct HMDMatrices {
 	glm::mat4 absolute_to_device;
 };
 
+// How the eye render targets are allocated
+enum class EyeLayout {
+	// A texture and framebuffer per eye
+	SEPARATE,
+	// One texture twice an eye's width, the left eye on the left half
+	SIDE_BY_SIDE,
+	// One array texture with a layer per eye, for rendering both eyes in
+	// a single pass with begin_stereo
+	LAYERED
+};
+
 struct OpenVRDisplay {
-	OpenVRDisplay();
-	~OpenVRDisplay();
+	// Render to the headset behind the backend. The eye targets only get a
+	// depth buffer if depth is set, drawing the panorama alone doesn't
+	// need one
+	OpenVRDisplay(std::unique_ptr<VRBackend> backend, EyeLayout layout = EyeLayout::SEPARATE,
+			bool depth = true);
 	// Begin rendering a new frame, waits for tracked device poses and
-	// updates the HMD transform
+	// updates the HMD transform, and collects the compositor's timing of
+	// the previous frame
 	void begin_frame();
-	// Start rendering a specific eye and get back the view & projection
-	// matrices to use for it
-	void begin_eye(size_t i, glm::mat4 &view, glm::mat4 &proj);
+	// Predict the HMD transform again to render with, shortening the time
+	// between reading the pose and drawing with it. Call it just before
+	// drawing, after the frame's other work
+	void latch_pose();
+	// Each eye's projection and view matrix for the current HMD transform,
+	// with the translation removed since the panorama is infinitely far
+	std::array<glm::mat4, 2> eye_proj_views() const;
+	// Record the age of the HMD transform, call just before drawing with it
+	void record_pose_age();
+	// Average age of the HMD transform when drawing, in milliseconds
+	double average_pose_age_ms() const;
+	// Start rendering a specific eye. With a side by side layout both
+	// eyes share the framebuffer, so clearing it clears both
+	void begin_eye(size_t i);
+	// Start rendering both eyes in a single pass, layer 0 of the target
+	// is the left eye and layer 1 the right
+	void begin_stereo();
+	// Get the eye's hidden area mesh from the backend
+	HiddenAreaMesh hidden_area_mesh(size_t i) const;
+	// Write the hidden area mask into both eyes' depth buffers, which the
+	// display must have been created with
+	void mask_hidden_area(HiddenAreaMask &mask);
 	// Submit both rendered eyes to the HMD
 	void submit();
+	// The angular resolution of the eye buffers at the center of view, in
+	// pixels per radian, taking the highest of each eye's horizontal and
+	// vertical resolution
+	float pixels_per_radian() const;
 
-	vr::IVRSystem *system;
-	vr::IVRCompositor *compositor;
-	std::array<vr::TrackedDevicePose_t, vr::k_unMaxTrackedDeviceCount> tracked_devices;
+	std::unique_ptr<VRBackend> backend;
 	std::array<EyeFBDesc, 2> eye_fbs;
+	EyeLayout layout;
+	bool depth;
+	// Holds both eyes for the side by side and layered layouts
+	GLFramebuffer stereo_fb;
 	HMDMatrices hmd_mats;
 	std::array<uint32_t, 2> render_dims;
+	// When the HMD transform was last read from the backend
+	std::chrono::steady_clock::time_point pose_time;
+	// Time begin_frame spent waiting for poses, and if the compositor
+	// reported dropping the previous frame when it returned
+	float wait_ms;
+	bool dropped_frame;
+	double pose_age_total_ms, pose_age_max_ms;
+	uint64_t pose_age_samples;
+	// The compositor's timing of the last frames, about 45s at 90Hz. It
+	// can be read from any thread while rendering
+	TelemetryRing<FrameTiming> frame_timings;
+	uint32_t last_frame_timing_index;
 };
 
-#endif
-
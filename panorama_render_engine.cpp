@@ -0,0 +1,473 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "common/sg/common/FrameBuffer.h"
+#include "panorama_render_engine.h"
+
+using namespace ospcommon;
+using namespace ospray;
+
+// Bilinearly upsample an RGBA8 image made of panels side by side, without
+// blending across the panels' edges
+static void upsample(const uint32_t *src, int src_width, int src_height,
+		uint32_t *dst, int width, int height, int panels)
+{
+	const int src_panel = src_width / panels;
+	const int panel = width / panels;
+	// Source columns and weights are the same for every row
+	std::vector<int> x0(width), x1(width);
+	std::vector<float> fx(width);
+	for (int x = 0; x < width; ++x) {
+		const int p = std::min(x / panel, panels - 1);
+		const int lo = p * src_panel;
+		const int hi = std::max(p == panels - 1 ? src_width - 1 : lo + src_panel - 1, lo);
+		const float sx = std::max((x - p * panel + 0.5f) * src_panel / panel - 0.5f, 0.f);
+		x0[x] = std::min(lo + static_cast<int>(sx), hi);
+		x1[x] = std::min(x0[x] + 1, hi);
+		fx[x] = sx - static_cast<int>(sx);
+	}
+	for (int y = 0; y < height; ++y) {
+		const float sy = std::max((y + 0.5f) * src_height / height - 0.5f, 0.f);
+		const int y0 = std::min(static_cast<int>(sy), src_height - 1);
+		const int y1 = std::min(y0 + 1, src_height - 1);
+		const float fy = sy - static_cast<int>(sy);
+		const uint32_t *row0 = src + size_t(y0) * src_width;
+		const uint32_t *row1 = src + size_t(y1) * src_width;
+		uint32_t *out = dst + size_t(y) * width;
+		for (int x = 0; x < width; ++x) {
+			const uint32_t a = row0[x0[x]], b = row0[x1[x]];
+			const uint32_t c = row1[x0[x]], d = row1[x1[x]];
+			uint32_t px = 0;
+			for (int shift = 0; shift < 32; shift += 8) {
+				const float top = ((a >> shift) & 0xff) * (1.f - fx[x]) + ((b >> shift) & 0xff) * fx[x];
+				const float bottom = ((c >> shift) & 0xff) * (1.f - fx[x]) + ((d >> shift) & 0xff) * fx[x];
+				px |= static_cast<uint32_t>(top * (1.f - fy) + bottom * fy + 0.5f) << shift;
+			}
+			out[x] = px;
+		}
+	}
+}
+
+PanoramaRenderEngine::PanoramaRenderEngine(std::shared_ptr<sg::Frame> scenegraph)
+	: scenegraph(scenegraph), sink(nullptr), running(false), frame_time(0.f),
+	edits(256), track_tiles(false),
+	tile_queue(nullptr), tile_stream_op(nullptr), streamed_fb(nullptr),
+	view_regions_changed(false), view_frames(0), full_frames(0),
+	progressive_levels(0), progressive_panels(1), governor(nullptr)
+{}
+PanoramaRenderEngine::~PanoramaRenderEngine() {
+	stop();
+	if (tile_stream_op) {
+		ospRelease(tile_stream_op);
+	}
+	for (auto &fb : coarse_fbs) {
+		if (fb) {
+			ospRelease(fb);
+		}
+	}
+}
+void PanoramaRenderEngine::set_sink(PanoramaSink *s) {
+	if (running) {
+		throw std::runtime_error("Can't change the panorama sink while rendering");
+	}
+	sink = s;
+}
+void PanoramaRenderEngine::track_dirty_tiles(bool track) {
+	if (running) {
+		throw std::runtime_error("Can't change dirty tile tracking while rendering");
+	}
+	track_tiles = track;
+}
+void PanoramaRenderEngine::stream_tiles(TileQueue *queue) {
+	if (running) {
+		throw std::runtime_error("Can't change tile streaming while rendering");
+	}
+	tile_queue = queue;
+}
+bool PanoramaRenderEngine::queue_edit(const char *name, const std::function<void()> &edit,
+		uint64_t tag)
+{
+	return edits.push([&](SceneEdit &e) {
+		e.name = name;
+		e.apply = edit;
+		e.tag = tag;
+	});
+}
+const std::map<std::string, SceneEditStats>& PanoramaRenderEngine::edit_stats() const {
+	return edit_timings;
+}
+void PanoramaRenderEngine::set_progressive(int levels, int panels) {
+	if (running) {
+		throw std::runtime_error("Can't change progressive refinement while rendering");
+	}
+	progressive_levels = levels;
+	progressive_panels = panels;
+}
+void PanoramaRenderEngine::set_governor(ResolutionGovernor *g) {
+	if (running) {
+		throw std::runtime_error("Can't change the resolution governor while rendering");
+	}
+	governor = g;
+}
+void PanoramaRenderEngine::set_frame_callback(const std::function<void()> &callback) {
+	if (running) {
+		throw std::runtime_error("Can't change the frame callback while rendering");
+	}
+	frame_callback = callback;
+}
+void PanoramaRenderEngine::set_view_regions(const std::vector<TileRect> &regions) {
+	std::lock_guard<std::mutex> lock(view_mutex);
+	requested_view_regions = regions;
+	view_regions_changed = true;
+}
+void PanoramaRenderEngine::start() {
+	if (running) {
+		return;
+	}
+	running = true;
+	thread = std::thread([&](){ render_loop(); });
+}
+void PanoramaRenderEngine::stop() {
+	if (!running) {
+		return;
+	}
+	running = false;
+	thread.join();
+}
+bool PanoramaRenderEngine::has_new_frame() const {
+	return frames.has_new();
+}
+const std::vector<uint32_t>& PanoramaRenderEngine::map_framebuffer() {
+	frames.acquire();
+	return frames.front_buffer().pixels;
+}
+void PanoramaRenderEngine::unmap_framebuffer() {
+	// The mapped frame is ours until the next map, there's nothing to release
+}
+const std::vector<TileRect>& PanoramaRenderEngine::dirty_tiles() const {
+	return frames.front_buffer().dirty_rects;
+}
+uint64_t PanoramaRenderEngine::frame_tag() const {
+	return frames.front_buffer().tag;
+}
+vec2i PanoramaRenderEngine::frame_size() const {
+	return frames.front_buffer().size;
+}
+float PanoramaRenderEngine::last_frame_time() const {
+	return frame_time;
+}
+void PanoramaRenderEngine::render_loop() {
+	sg::TimeStamp last_commit;
+	bool committed = false;
+	uint64_t commit_tag = 0;
+	int coarse_level = 0;
+	while (running) {
+		// Frame boundary: apply all the edits queued since the last frame and
+		// commit them at once, the tag can't get ahead of the scene it's for
+		// since both are taken in the same order they were queued
+		const bool edited = apply_edits(commit_tag);
+		if (!committed || edited || scenegraph->childrenLastModified() > last_commit) {
+			const auto start = std::chrono::steady_clock::now();
+			scenegraph->verify();
+			scenegraph->commit();
+			if (edited) {
+				const double ms = std::chrono::duration<double, std::milli>(
+						std::chrono::steady_clock::now() - start).count();
+				SceneEditStats &stats = edit_timings["commit"];
+				++stats.count;
+				stats.total_ms += ms;
+				stats.max_ms = std::max(stats.max_ms, ms);
+			}
+			last_commit = sg::TimeStamp();
+			committed = true;
+			if (tile_queue) {
+				attach_tile_stream();
+			}
+			// Everything accumulated so far is of the old scene
+			full_frames = 0;
+			view_frames = 0;
+			coarse_level = progressive_levels;
+			for (auto &v : view_regions) {
+				ospFrameBufferClear(v.fb, OSP_FB_ACCUM);
+			}
+		}
+
+		const vec2i size = scenegraph->child("frameBuffer")["size"].valueAs<vec2i>();
+		if (!tile_queue) {
+			update_view_regions(size.x, size.y);
+		}
+		// Once there's a first full frame to fill in the periphery, spend
+		// frames on the view until it's converged or the full frame has
+		// accumulated as much anyway
+		const int level = coarse_level;
+		const bool render_views = level == 0 && !view_regions.empty() && full_frames > 0
+			&& full_frames < view_priority_frames && view_frames < view_priority_frames;
+
+		const auto start = std::chrono::steady_clock::now();
+		std::shared_ptr<sg::FrameBuffer> fb;
+		if (level > 0) {
+			render_coarse(level, size.x, size.y);
+			--coarse_level;
+		} else if (render_views) {
+			render_view_regions(size.x, size.y);
+			++view_frames;
+		} else {
+			fb = scenegraph->renderFrame(true);
+			++full_frames;
+		}
+		const auto end = std::chrono::steady_clock::now();
+		// Coarse levels and view regions cover fewer pixels, so only full
+		// frames measure the cost of the panorama
+		if (level == 0 && !render_views) {
+			const float ms = std::chrono::duration<float, std::milli>(end - start).count();
+			frame_time = ms;
+			// The new size is committed and picked up with the next frame
+			if (governor && governor->update(ms)) {
+				scenegraph->child("frameBuffer")["size"].setValue(governor->size());
+			}
+		}
+
+		if (level > 0) {
+			if (tile_queue) {
+				stream_frame(upsampled.data(), size.x, size.y);
+			} else {
+				publish(upsampled.data(), size.x, size.y, commit_tag);
+			}
+			continue;
+		}
+
+		// The tiles have already been sent on by the pixel op
+		if (tile_queue) {
+			continue;
+		}
+
+		if (view_regions.empty()) {
+			const vec2i fb_size = fb->size();
+			const uint32_t *pixels = static_cast<const uint32_t*>(fb->map());
+			publish(pixels, fb_size.x, fb_size.y, commit_tag);
+			fb->unmap(pixels);
+			continue;
+		}
+		if (fb) {
+			const uint32_t *pixels = static_cast<const uint32_t*>(fb->map());
+			composite_frame(pixels, size.x, size.y);
+			fb->unmap(pixels);
+		}
+		publish(composite.data(), size.x, size.y, commit_tag);
+	}
+	release_view_regions();
+}
+bool PanoramaRenderEngine::apply_edits(uint64_t &tag) {
+	bool applied = false;
+	SceneEdit edit;
+	while (edits.pop([&](SceneEdit &e) {
+				edit.name = e.name;
+				edit.apply = std::move(e.apply);
+				edit.tag = e.tag;
+				e.apply = nullptr;
+			}))
+	{
+		applied = true;
+		if (edit.tag != 0) {
+			tag = edit.tag;
+		}
+		if (!edit.apply) {
+			continue;
+		}
+		const auto start = std::chrono::steady_clock::now();
+		edit.apply();
+		const double ms = std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - start).count();
+		SceneEditStats &stats = edit_timings[edit.name];
+		++stats.count;
+		stats.total_ms += ms;
+		stats.max_ms = std::max(stats.max_ms, ms);
+	}
+	return applied;
+}
+void PanoramaRenderEngine::update_view_regions(int width, int height) {
+	const size_t num_pixels = size_t(width) * height;
+	std::vector<TileRect> regions;
+	{
+		std::lock_guard<std::mutex> lock(view_mutex);
+		if (!view_regions_changed && (view_regions.empty() || composite.size() == num_pixels)) {
+			return;
+		}
+		regions = requested_view_regions;
+		view_regions_changed = false;
+	}
+
+	release_view_regions();
+	view_frames = 0;
+	if (composite.size() != num_pixels) {
+		// The composite needs a full frame to start from
+		composite.assign(num_pixels, 0);
+		full_frames = 0;
+	}
+	for (const auto &r : regions) {
+		const int x0 = std::max(r.x, 0);
+		const int y0 = std::max(r.y, 0);
+		const int x1 = std::min(r.x + r.width, width);
+		const int y1 = std::min(r.y + r.height, height);
+		if (x1 <= x0 || y1 <= y0) {
+			continue;
+		}
+		const osp::vec2i fb_size = {x1 - x0, y1 - y0};
+		OSPFrameBuffer fb = ospNewFrameBuffer(fb_size, OSP_FB_SRGBA, OSP_FB_COLOR | OSP_FB_ACCUM);
+		view_regions.push_back(ViewRegion{TileRect{x0, y0, x1 - x0, y1 - y0}, fb});
+	}
+}
+void PanoramaRenderEngine::render_view_regions(int width, int height) {
+	OSPRenderer renderer = scenegraph->child("renderer").valueAs<OSPRenderer>();
+	OSPCamera camera = scenegraph->child("camera").valueAs<OSPCamera>();
+	for (const auto &v : view_regions) {
+		// Render just the region's part of the panorama at its resolution
+		// in the full frame
+		ospSet2f(camera, "imageStart", float(v.rect.x) / width, float(v.rect.y) / height);
+		ospSet2f(camera, "imageEnd", float(v.rect.x + v.rect.width) / width,
+				float(v.rect.y + v.rect.height) / height);
+		ospCommit(camera);
+		ospRenderFrame(v.fb, renderer, OSP_FB_COLOR | OSP_FB_ACCUM);
+		copy_view_region(v.rect, v.fb, width);
+	}
+	ospSet2f(camera, "imageStart", 0.f, 0.f);
+	ospSet2f(camera, "imageEnd", 1.f, 1.f);
+	ospCommit(camera);
+}
+void PanoramaRenderEngine::copy_view_region(const TileRect &rect, OSPFrameBuffer fb, int width) {
+	const uint32_t *pixels = static_cast<const uint32_t*>(ospMapFrameBuffer(fb, OSP_FB_COLOR));
+	for (int y = 0; y < rect.height; ++y) {
+		std::memcpy(&composite[size_t(rect.y + y) * width + rect.x],
+				pixels + size_t(y) * rect.width, rect.width * sizeof(uint32_t));
+	}
+	ospUnmapFrameBuffer(pixels, fb);
+}
+void PanoramaRenderEngine::composite_frame(const uint32_t *pixels, int width, int height) {
+	std::memcpy(composite.data(), pixels, size_t(width) * height * sizeof(uint32_t));
+	if (view_frames > full_frames) {
+		for (const auto &v : view_regions) {
+			copy_view_region(v.rect, v.fb, width);
+		}
+	}
+}
+void PanoramaRenderEngine::release_view_regions() {
+	for (auto &v : view_regions) {
+		ospRelease(v.fb);
+	}
+	view_regions.clear();
+}
+void PanoramaRenderEngine::render_coarse(int level, int width, int height) {
+	const int coarse_width = std::max(width >> level, progressive_panels);
+	const int coarse_height = std::max(height >> level, 1);
+	if (coarse_fbs.size() < size_t(level)) {
+		coarse_fbs.resize(level, nullptr);
+	}
+	// The upsampled buffer tracks the full size, the coarse levels are
+	// recreated when it changes
+	if (upsampled.size() != size_t(width) * height) {
+		for (auto &f : coarse_fbs) {
+			if (f) {
+				ospRelease(f);
+				f = nullptr;
+			}
+		}
+		upsampled.resize(size_t(width) * height);
+	}
+	OSPFrameBuffer &fb = coarse_fbs[level - 1];
+	if (!fb) {
+		const osp::vec2i fb_size = {coarse_width, coarse_height};
+		fb = ospNewFrameBuffer(fb_size, OSP_FB_SRGBA, OSP_FB_COLOR);
+	}
+	OSPRenderer renderer = scenegraph->child("renderer").valueAs<OSPRenderer>();
+	ospRenderFrame(fb, renderer, OSP_FB_COLOR);
+
+	const uint32_t *pixels = static_cast<const uint32_t*>(ospMapFrameBuffer(fb, OSP_FB_COLOR));
+	upsample(pixels, coarse_width, coarse_height, upsampled.data(), width, height,
+			progressive_panels);
+	ospUnmapFrameBuffer(pixels, fb);
+}
+void PanoramaRenderEngine::stream_frame(const uint32_t *pixels, int width, int height) {
+	for (int y = 0; y < height; y += STREAMED_TILE_SIZE) {
+		for (int x = 0; x < width; x += STREAMED_TILE_SIZE) {
+			tile_queue->push([&](StreamedTile &t) {
+				t.x = x;
+				t.y = y;
+				t.width = std::min(STREAMED_TILE_SIZE, width - x);
+				t.height = std::min(STREAMED_TILE_SIZE, height - y);
+				t.frame_width = width;
+				t.frame_height = height;
+				for (int i = 0; i < t.height; ++i) {
+					std::memcpy(&t.pixels[i * STREAMED_TILE_SIZE], pixels + size_t(y + i) * width + x,
+							t.width * sizeof(uint32_t));
+				}
+			});
+		}
+	}
+}
+void PanoramaRenderEngine::attach_tile_stream() {
+	if (!tile_stream_op) {
+		tile_stream_op = ospNewPixelOp("tile_stream");
+		if (!tile_stream_op) {
+			throw std::runtime_error("Failed to create tile_stream pixel op, is the openvr module loaded?");
+		}
+		ospSetVoidPtr(tile_stream_op, "queue", tile_queue);
+		ospCommit(tile_stream_op);
+	}
+	OSPFrameBuffer fb = scenegraph->child("frameBuffer").valueAs<OSPFrameBuffer>();
+	if (fb != streamed_fb) {
+		ospSetPixelOp(fb, tile_stream_op);
+		streamed_fb = fb;
+	}
+}
+void PanoramaRenderEngine::publish(const uint32_t *pixels, int width, int height,
+		uint64_t tag)
+{
+	const size_t num_pixels = size_t(width) * height;
+	if (sink) {
+		uint32_t *dst = sink->begin_write(width, height);
+		if (dst) {
+			std::memcpy(dst, pixels, num_pixels * sizeof(uint32_t));
+			sink->end_write(tag);
+			if (frame_callback) {
+				frame_callback();
+			}
+		}
+		return;
+	}
+
+	PublishedFrame &back = frames.back_buffer();
+	back.pixels.resize(num_pixels);
+	std::memcpy(back.pixels.data(), pixels, num_pixels * sizeof(uint32_t));
+	back.tag = tag;
+	back.size = vec2i(width, height);
+	if (track_tiles) {
+		if (!tracker || tracker->width != width || tracker->height != height) {
+			tracker.reset(new DirtyTiles(width, height));
+			unseen_mask.clear();
+		}
+		frame_mask.assign(tracker->tiles_x * tracker->tiles_y, 0);
+		tracker->update(pixels, frame_mask);
+		unseen_mask.resize(frame_mask.size(), 1);
+		for (size_t i = 0; i < frame_mask.size(); ++i) {
+			unseen_mask[i] |= frame_mask[i];
+		}
+		tracker->dirty_rects(unseen_mask, back.dirty_rects);
+	} else {
+		back.dirty_rects.clear();
+		back.dirty_rects.push_back(TileRect{0, 0, width, height});
+	}
+
+	// Like the AsyncRenderEngine we never wait on the GL thread, frames it
+	// doesn't map in time are replaced by newer ones
+	const bool replaced_unseen = frames.publish();
+	if (track_tiles && !replaced_unseen) {
+		// The GL thread mapped the frame before this one, so the next frame
+		// only has to carry this one's changes. If it skipped a frame, that
+		// frame's changes stay in the mask until one it maps carries them
+		unseen_mask = frame_mask;
+	}
+	if (frame_callback) {
+		frame_callback();
+	}
+}
+
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common/sg/SceneGraph.h"
+#include "bounded_queue.h"
+#include "dirty_tiles.h"
+#include "resolution_governor.h"
+#include "tile_stream.h"
+#include "triple_buffer.h"
+
+// A destination for finished panoramas outside of the render engine,
+// e.g. memory the GL side can transfer from directly. Called from the
+// engine's render thread.
+struct PanoramaSink {
+	virtual ~PanoramaSink() {}
+	// Get memory to write a width x height RGBA8 panorama into, or null
+	// if there's no free space and the frame should be dropped
+	virtual uint32_t* begin_write(int width, int height) = 0;
+	// Publish the panorama written since the last begin_write, rendered
+	// with the scene tagged tag, see PanoramaRenderEngine::queue_edit
+	virtual void end_write(uint64_t tag) = 0;
+};
+
+// Time the render thread spent applying one kind of scene graph edit
+struct SceneEditStats {
+	size_t count;
+	double total_ms, max_ms;
+
+	SceneEditStats() : count(0), total_ms(0.0), max_ms(0.0) {}
+	double average_ms() const {
+		return count > 0 ? total_ms / count : 0.0;
+	}
+};
+
+// Renders the panorama on a background thread, committing scene graph
+// changes between frames like OSPRay's AsyncRenderEngine. By default
+// finished frames are handed to the GL thread through a wait-free triple
+// buffer and picked up through map_framebuffer, or, if a sink is set,
+// copied straight into the sink so each pixel is written once on its way
+// out of OSPRay.
+struct PanoramaRenderEngine {
+	PanoramaRenderEngine(std::shared_ptr<ospray::sg::Frame> scenegraph);
+	~PanoramaRenderEngine();
+	PanoramaRenderEngine(const PanoramaRenderEngine&) = delete;
+	PanoramaRenderEngine& operator=(const PanoramaRenderEngine&) = delete;
+	// Write finished frames to the sink instead of the engine's own pixel
+	// buffers. Must be set while the engine is stopped
+	void set_sink(PanoramaSink *sink);
+	// Compare each frame against the previous one so only the tiles which
+	// changed need to be uploaded. Must be set while the engine is stopped,
+	// and only applies to frames published to the engine's pixel buffers
+	void track_dirty_tiles(bool track);
+	// Push tiles to the queue as soon as they're rendered through the
+	// module's tile_stream pixel op, instead of publishing whole frames.
+	// Requires the openvr module to be loaded and must be set while the
+	// engine is stopped
+	void stream_tiles(TileQueue *queue);
+	// After each scene change, render a frame at each of the given number of
+	// coarse levels (1/2^levels resolution up to 1/2) and upsample it to
+	// the full size before accumulating at full resolution, so there's an
+	// image to show quickly. The panorama is made of panels side by side,
+	// e.g. the faces of a cube map, which upsampling won't blend across.
+	// Must be set while the engine is stopped
+	void set_progressive(int levels, int panels = 1);
+	// Let the governor resize the panorama to keep the frame time near its
+	// target. Published frames change size along with it. Must be set while
+	// the engine is stopped
+	void set_governor(ResolutionGovernor *governor);
+	// Called from the engine's thread after each frame is published, to
+	// wake up whoever displays them instead of having them poll. It must
+	// not block. Must be set while the engine is stopped
+	void set_frame_callback(const std::function<void()> &callback);
+	// Queue an edit to the scene graph while rendering, instead of editing
+	// it from another thread. Edits are applied in order on the render
+	// thread between frames, everything queued since the last frame is
+	// committed together once. If tag is non-zero the commit is tagged with
+	// it, so the GL side can tell which frames were rendered with the edit:
+	// each frame carries the tag of the commit it was rendered with. name
+	// labels the edit in edit_stats and must be a string literal. Returns
+	// false if the queue is full and the edit was dropped, never blocks
+	bool queue_edit(const char *name, const std::function<void()> &edit, uint64_t tag = 0);
+	// Time spent applying each kind of edit, and committing after them
+	// under "commit". Only valid while the engine is stopped
+	const std::map<std::string, SceneEditStats>& edit_stats() const;
+	// Prioritize the regions of the panorama in view. After each camera
+	// change the engine renders one full frame, then only the view regions
+	// until they've accumulated view_priority_frames, before refining the
+	// rest of the panorama. Setting new regions restarts their accumulation,
+	// the regions are ignored when streaming tiles. Can be called while
+	// rendering
+	void set_view_regions(const std::vector<TileRect> &regions);
+	void start();
+	void stop();
+	// Check if a frame newer than the last one mapped is available
+	bool has_new_frame() const;
+	// Map the most recent frame, or the last one mapped if there isn't a
+	// newer one. It stays valid until the next call to map_framebuffer,
+	// the engine keeps publishing into its other buffers meanwhile
+	const std::vector<uint32_t>& map_framebuffer();
+	void unmap_framebuffer();
+	// The regions of the mapped frame which changed since the previous
+	// frame that was mapped. Covers the whole frame if tiles aren't tracked
+	const std::vector<TileRect>& dirty_tiles() const;
+	// The tag of the scene the mapped frame was rendered with
+	uint64_t frame_tag() const;
+	// The size of the mapped frame
+	ospcommon::vec2i frame_size() const;
+	// Time taken by OSPRay to render the last full resolution frame of the
+	// whole panorama, in milliseconds
+	float last_frame_time() const;
+
+	void render_loop();
+	// Apply the queued edits, taking up the latest tag among them. Returns
+	// true if there were any
+	bool apply_edits(uint64_t &tag);
+	// Attach the tile_stream pixel op to the current OSPRay framebuffer,
+	// which the scene graph recreates when it's resized
+	void attach_tile_stream();
+	// Take up changed view regions and create their framebuffers
+	void update_view_regions(int width, int height);
+	void render_view_regions(int width, int height);
+	void copy_view_region(const TileRect &rect, OSPFrameBuffer fb, int width);
+	// Copy the full frame into the composite around the view regions, or
+	// over them too once it's accumulated at least as many frames
+	void composite_frame(const uint32_t *pixels, int width, int height);
+	void release_view_regions();
+	// Render the coarse level and upsample it into the upsampled buffer
+	void render_coarse(int level, int width, int height);
+	// Push a whole frame to the tile queue
+	void stream_frame(const uint32_t *pixels, int width, int height);
+	void publish(const uint32_t *pixels, int width, int height, uint64_t tag);
+
+	std::shared_ptr<ospray::sg::Frame> scenegraph;
+	PanoramaSink *sink;
+	std::thread thread;
+	std::atomic<bool> running;
+	std::atomic<float> frame_time;
+	struct SceneEdit {
+		const char *name;
+		std::function<void()> apply;
+		uint64_t tag;
+	};
+	BoundedQueue<SceneEdit> edits;
+	// Only touched by the render thread
+	std::map<std::string, SceneEditStats> edit_timings;
+	struct PublishedFrame {
+		std::vector<uint32_t> pixels;
+		// The regions changed since the last frame the GL thread mapped
+		std::vector<TileRect> dirty_rects;
+		uint64_t tag;
+		ospcommon::vec2i size;
+	};
+	TripleBuffer<PublishedFrame> frames;
+	std::function<void()> frame_callback;
+
+	bool track_tiles;
+	std::unique_ptr<DirtyTiles> tracker;
+	// Tiles changed in the frame being published, and in all the frames
+	// published since the last one we know was mapped
+	std::vector<uint8_t> frame_mask, unseen_mask;
+
+	TileQueue *tile_queue;
+	OSPPixelOp tile_stream_op;
+	OSPFrameBuffer streamed_fb;
+
+	struct ViewRegion {
+		TileRect rect;
+		OSPFrameBuffer fb;
+	};
+	static const size_t view_priority_frames = 32;
+	std::mutex view_mutex;
+	std::vector<TileRect> requested_view_regions;
+	bool view_regions_changed;
+	// Only touched by the render thread
+	std::vector<ViewRegion> view_regions;
+	// Frames accumulated in the view regions' framebuffers and the full
+	// framebuffer since they were last reset
+	size_t view_frames, full_frames;
+	// The panorama assembled from the full frame and the view regions
+	std::vector<uint32_t> composite;
+
+	int progressive_levels, progressive_panels;
+	// Framebuffers for each coarse level, level i is at index i - 1
+	std::vector<OSPFrameBuffer> coarse_fbs;
+	std::vector<uint32_t> upsampled;
+
+	ResolutionGovernor *governor;
+};
+
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "panorama_texture.h"
+
+PanoramaTexture::PanoramaTexture(int width, int height, PanoramaLayout layout, size_t num_pbos)
+	: target(layout == PanoramaLayout::CUBE_MAP ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D),
+	layout(layout), width(width), height(height), pbos(num_pbos, 0), fences(num_pbos, nullptr), next_pbo(0),
+	tile_buffer(nullptr)
+{
+	allocate();
+}
+PanoramaTexture::~PanoramaTexture() {
+	release();
+}
+void PanoramaTexture::resize(int w, int h) {
+	if (w == width && h == height) {
+		return;
+	}
+	release();
+	width = w;
+	height = h;
+	allocate();
+}
+void PanoramaTexture::allocate() {
+	if (layout == PanoramaLayout::CUBE_MAP && width != 6 * height) {
+		throw std::runtime_error("Cube map panoramas must have six square faces side by side");
+	}
+	// Each face of a cube map is a square as tall as the panorama
+	const int tex_width = layout == PanoramaLayout::CUBE_MAP ? height : width;
+
+	glGenTextures(1, &texture);
+	glBindTexture(target, texture);
+	// Immutable storage is core in 4.2, but widely exposed on 3.3 contexts
+	// through ARB_texture_storage
+	if (glTexStorage2D) {
+		glTexStorage2D(target, 1, GL_RGBA8, tex_width, height);
+	} else if (layout == PanoramaLayout::CUBE_MAP) {
+		for (GLenum f = 0; f < 6; ++f) {
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, GL_RGBA8, tex_width, height, 0,
+					GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+	} else {
+		glTexImage2D(target, 0, GL_RGBA8, tex_width, height, 0,
+				GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	}
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	if (layout == PanoramaLayout::CUBE_MAP) {
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+
+	const GLsizeiptr frame_bytes = GLsizeiptr(width) * height * 4;
+	glGenBuffers(pbos.size(), pbos.data());
+	for (auto &b : pbos) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, b);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, frame_bytes, nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+void PanoramaTexture::release() {
+	for (auto &f : fences) {
+		if (f) {
+			glDeleteSync(f);
+			f = nullptr;
+		}
+	}
+	glDeleteBuffers(pbos.size(), pbos.data());
+	glDeleteTextures(1, &texture);
+	next_pbo = 0;
+}
+void PanoramaTexture::upload(const void *pixels) {
+	upload(pixels, std::vector<TileRect>{TileRect{0, 0, width, height}});
+}
+void PanoramaTexture::upload(const void *pixels, const std::vector<TileRect> &rects) {
+	if (rects.empty()) {
+		return;
+	}
+	// The buffer mirrors the layout of the full panorama, but only the
+	// regions being uploaded are written to it
+	uint8_t *dst = map_next_buffer();
+	const uint8_t *src = static_cast<const uint8_t*>(pixels);
+	for (const auto &r : rects) {
+		if (r.x == 0 && r.width == width) {
+			const size_t offset = size_t(r.y) * width * 4;
+			std::memcpy(dst + offset, src + offset, size_t(r.width) * r.height * 4);
+			continue;
+		}
+		for (int y = r.y; y < r.y + r.height; ++y) {
+			const size_t offset = (size_t(y) * width + r.x) * 4;
+			std::memcpy(dst + offset, src + offset, size_t(r.width) * 4);
+		}
+	}
+	upload_mapped_buffer(rects);
+}
+void PanoramaTexture::upload_from_buffer(GLuint buffer, size_t offset) {
+	// Sourced from an unpack buffer, so this returns immediately and the
+	// driver performs the transfer asynchronously
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	glBindTexture(target, texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+	upload_rect(TileRect{0, 0, width, height}, offset);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+void PanoramaTexture::begin_tiles() {
+	tile_rects.clear();
+}
+void PanoramaTexture::write_tile(const StreamedTile &tile) {
+	// Tiles from a frame of a different size than the texture are dropped
+	if (tile.x < 0 || tile.y < 0 || tile.x + tile.width > width || tile.y + tile.height > height) {
+		return;
+	}
+	// Only map a buffer once we actually have tiles, so frames without
+	// any new tiles don't cycle through the ring
+	if (!tile_buffer) {
+		tile_buffer = map_next_buffer();
+	}
+	for (int y = 0; y < tile.height; ++y) {
+		std::memcpy(tile_buffer + (size_t(tile.y + y) * width + tile.x) * 4,
+				&tile.pixels[y * STREAMED_TILE_SIZE], size_t(tile.width) * 4);
+	}
+	tile_rects.push_back(TileRect{tile.x, tile.y, tile.width, tile.height});
+}
+void PanoramaTexture::end_tiles() {
+	if (tile_buffer) {
+		upload_mapped_buffer(tile_rects);
+		tile_buffer = nullptr;
+	}
+}
+uint8_t* PanoramaTexture::map_next_buffer() {
+	const GLsizeiptr frame_bytes = GLsizeiptr(width) * height * 4;
+	GLsync &fence = fences[next_pbo];
+	// The buffer may only be rewritten once the GPU is done reading the
+	// panorama we last put in it. With a few buffers in the ring this
+	// transfer has long completed and we don't actually wait here.
+	if (fence) {
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[next_pbo]);
+	uint8_t *dst = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, frame_bytes,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+	if (!dst) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		throw std::runtime_error("Failed to map panorama upload buffer");
+	}
+	return dst;
+}
+void PanoramaTexture::upload_mapped_buffer(const std::vector<TileRect> &rects) {
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[next_pbo]);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	// Sourced from the unpack buffer, so these return immediately and the
+	// driver performs the transfers asynchronously
+	glBindTexture(target, texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+	for (const auto &r : rects) {
+		upload_rect(r, 0);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	fences[next_pbo] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	next_pbo = (next_pbo + 1) % pbos.size();
+}
+void PanoramaTexture::upload_rect(const TileRect &r, size_t buffer_offset) {
+	if (layout == PanoramaLayout::EQUIRECT) {
+		const size_t offset = buffer_offset + (size_t(r.y) * width + r.x) * 4;
+		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.width, r.height, GL_RGBA,
+				GL_UNSIGNED_BYTE, reinterpret_cast<const void*>(offset));
+		return;
+	}
+	const int face_size = height;
+	const int first_face = r.x / face_size;
+	const int last_face = (r.x + r.width - 1) / face_size;
+	for (int f = first_face; f <= last_face; ++f) {
+		const int x_begin = std::max(r.x, f * face_size);
+		const int x_end = std::min(r.x + r.width, (f + 1) * face_size);
+		const size_t offset = buffer_offset + (size_t(r.y) * width + x_begin) * 4;
+		glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, 0, x_begin - f * face_size, r.y,
+				x_end - x_begin, r.height, GL_RGBA, GL_UNSIGNED_BYTE,
+				reinterpret_cast<const void*>(offset));
+	}
+}
+
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <GL/gl3w.h>
+#include "dirty_tiles.h"
+#include "tile_stream.h"
+
+// How the panorama rendered by OSPRay is laid out
+enum class PanoramaLayout {
+	// A 2:1 equirectangular image from the panoramic camera
+	EQUIRECT,
+	// The six faces of a cube map side by side from the module's cubemap
+	// camera, in GL face order. Displayed from a GL_TEXTURE_CUBE_MAP, which
+	// also holds the faces of equi-angular cube maps
+	CUBE_MAP
+};
+
+// The panorama texture displayed in the headset. New panoramas are
+// streamed in through a ring of pixel unpack buffers so the copy out of
+// the OSPRay framebuffer and the transfer to the GPU can overlap with
+// rendering the eyes, instead of stalling the frame in glTexImage2D
+struct PanoramaTexture {
+	// Allocate immutable RGBA8 storage for a width x height panorama,
+	// streamed through a ring of num_pbos unpack buffers. For cube maps
+	// width and height are those of the image with all six faces
+	PanoramaTexture(int width, int height, PanoramaLayout layout = PanoramaLayout::EQUIRECT,
+			size_t num_pbos = 3);
+	~PanoramaTexture();
+	PanoramaTexture(const PanoramaTexture&) = delete;
+	PanoramaTexture& operator=(const PanoramaTexture&) = delete;
+	// Reallocate the texture and unpack buffers for a panorama of a new
+	// size, discarding the current panorama. The texture is bound to the
+	// active texture unit. Must not be called between begin_tiles and
+	// end_tiles
+	void resize(int width, int height);
+	// Copy a new panorama into the next unpack buffer in the ring and
+	// queue its transfer into the texture. The texture is bound to the
+	// active texture unit
+	void upload(const void *pixels);
+	// Upload just the given regions of a new panorama, e.g. the tiles
+	// which changed since the last upload
+	void upload(const void *pixels, const std::vector<TileRect> &rects);
+	// Queue the transfer of a panorama stored in a pixel unpack buffer at
+	// the given byte offset. The caller is responsible for fencing the
+	// buffer before it's rewritten
+	void upload_from_buffer(GLuint buffer, size_t offset);
+	// Stream in individual tiles as OSPRay finishes them. Tiles written
+	// between begin_tiles and end_tiles share an unpack buffer and are
+	// uploaded together by end_tiles
+	void begin_tiles();
+	void write_tile(const StreamedTile &tile);
+	void end_tiles();
+
+	void allocate();
+	void release();
+	// Wait until the next buffer in the ring is free and map it for writing,
+	// the buffer is left bound
+	uint8_t* map_next_buffer();
+	// Unmap the buffer mapped by map_next_buffer and upload the regions of
+	// the panorama written to it
+	void upload_mapped_buffer(const std::vector<TileRect> &rects);
+	// Transfer a region of the panorama from the bound unpack buffer into
+	// the texture, splitting it up between the faces of a cube map
+	void upload_rect(const TileRect &rect, size_t buffer_offset);
+
+	GLuint texture;
+	// GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP, depending on the layout
+	GLenum target;
+	PanoramaLayout layout;
+	int width, height;
+	std::vector<GLuint> pbos;
+	// Fences marking when the transfer out of each buffer has completed
+	std::vector<GLsync> fences;
+	size_t next_pbo;
+	// The buffer tiles are currently being written to and their regions
+	uint8_t *tile_buffer;
+	std::vector<TileRect> tile_rects;
+};
+
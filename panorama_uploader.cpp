@@ -0,0 +1,82 @@
+#include <chrono>
+#include <stdexcept>
+#include "panorama_uploader.h"
+
+PanoramaUploader::PanoramaUploader(PanoramaRenderEngine &engine, int width, int height,
+		PanoramaLayout layout, std::function<bool()> make_current,
+		std::function<void()> release_current, std::function<void()> published)
+	: engine(engine), make_current(make_current), release_current(release_current),
+	published(published),
+	running(true)
+{
+	for (auto &p : panoramas.slots) {
+		p.texture.reset(new PanoramaTexture(width, height, layout));
+		p.tag = 0;
+	}
+	// Make sure the textures exist before the worker's context uses them
+	glFinish();
+	// The worker reports whether it got its context, so failing to get one
+	// is thrown from here instead of taking down the worker thread
+	auto current = std::make_shared<std::promise<bool>>();
+	std::future<bool> started = current->get_future();
+	thread = std::thread([this, current]() {
+		if (!this->make_current()) {
+			current->set_value(false);
+			return;
+		}
+		current->set_value(true);
+		upload_loop();
+	});
+	if (!started.get()) {
+		thread.join();
+		throw std::runtime_error("Failed to make the upload context current on its thread");
+	}
+}
+PanoramaUploader::~PanoramaUploader() {
+	running = false;
+	wake.notify_one();
+	thread.join();
+}
+PanoramaTexture* PanoramaUploader::acquire(uint64_t &tag) {
+	if (!panoramas.acquire()) {
+		return nullptr;
+	}
+	tag = panoramas.front_buffer().tag;
+	return panoramas.front_buffer().texture.get();
+}
+PanoramaTexture& PanoramaUploader::displayed() {
+	return *panoramas.front_buffer().texture;
+}
+void PanoramaUploader::notify() {
+	wake.notify_one();
+}
+void PanoramaUploader::upload_loop() {
+	while (running) {
+		if (!engine.has_new_frame()) {
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			wake.wait_for(lock, std::chrono::milliseconds(10));
+			continue;
+		}
+		UploadedPanorama &back = panoramas.back_buffer();
+		const auto &pixels = engine.map_framebuffer();
+		const ospcommon::vec2i size = engine.frame_size();
+		back.tag = engine.frame_tag();
+		// The back texture missed the frames uploaded to the others since
+		// it was last written, so the engine's dirty tiles don't apply
+		back.texture->resize(size.x, size.y);
+		back.texture->upload(pixels.data());
+		engine.unmap_framebuffer();
+
+		// Only publish the texture once the transfer into it is done, so
+		// the display never waits on it
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		while (running && glClientWaitSync(fence, 0, 1000000) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(fence);
+		panoramas.publish();
+		if (published) {
+			published();
+		}
+	}
+	release_current();
+}
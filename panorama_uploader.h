@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "panorama_render_engine.h"
+#include "panorama_texture.h"
+#include "triple_buffer.h"
+
+// Uploads the render engine's frames on a worker thread with its own GL
+// context, shared with the display's, so uploads take no time out of the
+// VR frame however large the panorama is. Panoramas are triple buffered
+// between three textures: the worker uploads into the back one, waits on
+// a fence for the transfer to finish, then publishes it through a
+// TripleBuffer. The display takes the ready texture when there's a new
+// one, so all it does per frame is swap which texture it binds.
+struct PanoramaUploader {
+	// Allocate the textures on the current context, which the worker's
+	// context must share objects with. make_current is called on the
+	// worker thread to make its context current and returns false if it
+	// couldn't, in which case the constructor throws. release_current is
+	// called before the thread exits. published is called on the worker
+	// after each panorama is published, to wake up the display, and must
+	// not block
+	PanoramaUploader(PanoramaRenderEngine &engine, int width, int height, PanoramaLayout layout,
+			std::function<bool()> make_current, std::function<void()> release_current,
+			std::function<void()> published);
+	// Stops the worker and deletes the textures, on the current context
+	~PanoramaUploader();
+	PanoramaUploader(const PanoramaUploader&) = delete;
+	PanoramaUploader& operator=(const PanoramaUploader&) = delete;
+	// Take the most recently uploaded panorama if there's one newer than
+	// the last one taken, or return null. The texture stays the display's
+	// until the next one is taken. The tag is the frame tag it was
+	// rendered with
+	PanoramaTexture* acquire(uint64_t &tag);
+	// The texture last taken by acquire, or the first one before any were
+	PanoramaTexture& displayed();
+	// Wake the worker to upload a new frame from the engine, doesn't block
+	void notify();
+
+	void upload_loop();
+
+	struct UploadedPanorama {
+		std::unique_ptr<PanoramaTexture> texture;
+		uint64_t tag;
+	};
+
+	PanoramaRenderEngine &engine;
+	std::function<bool()> make_current;
+	std::function<void()> release_current, published;
+	TripleBuffer<UploadedPanorama> panoramas;
+	std::atomic<bool> running;
+	// The worker sleeps on wake until notified. The notifier doesn't take
+	// the lock, so a wake up can slip in just before the worker starts
+	// waiting and the wait has a timeout to pick it up
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	std::thread thread;
+};
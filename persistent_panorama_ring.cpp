@@ -0,0 +1,102 @@
+#include <stdexcept>
+#include "persistent_panorama_ring.h"
+
+PersistentPanoramaRing::PersistentPanoramaRing(int max_width, int max_height, size_t num_slots)
+	: buffer(0), mapping(nullptr),
+	slot_bytes(size_t(max_width) * max_height * 4),
+	slots(num_slots, Slot{SlotState::FREE, 0, 0, 0, 0, nullptr}),
+	frame_counter(0), writing(0)
+{
+	if (!glBufferStorage) {
+		throw std::runtime_error("Persistent panorama uploads require ARB_buffer_storage");
+	}
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const GLsizeiptr size = slot_bytes * slots.size();
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+	mapping = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags));
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (!mapping) {
+		glDeleteBuffers(1, &buffer);
+		throw std::runtime_error("Failed to persistently map panorama buffer");
+	}
+}
+PersistentPanoramaRing::~PersistentPanoramaRing() {
+	for (auto &s : slots) {
+		if (s.fence) {
+			glDeleteSync(s.fence);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glDeleteBuffers(1, &buffer);
+}
+uint32_t* PersistentPanoramaRing::begin_write(int w, int h) {
+	if (size_t(w) * h * 4 > slot_bytes) {
+		return nullptr;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	for (size_t i = 0; i < slots.size(); ++i) {
+		if (slots[i].state == SlotState::FREE) {
+			slots[i].state = SlotState::WRITING;
+			slots[i].width = w;
+			slots[i].height = h;
+			writing = i;
+			return reinterpret_cast<uint32_t*>(mapping + i * slot_bytes);
+		}
+	}
+	return nullptr;
+}
+void PersistentPanoramaRing::end_write(uint64_t tag) {
+	std::lock_guard<std::mutex> lock(mutex);
+	slots[writing].state = SlotState::READY;
+	slots[writing].frame = frame_counter++;
+	slots[writing].tag = tag;
+}
+bool PersistentPanoramaRing::upload_latest(PanoramaTexture &tex, uint64_t *tag) {
+	// Slots whose transfer has finished can be written again
+	for (auto &s : slots) {
+		if (s.fence) {
+			const GLenum status = glClientWaitSync(s.fence, 0, 0);
+			if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+				glDeleteSync(s.fence);
+				s.fence = nullptr;
+				std::lock_guard<std::mutex> lock(mutex);
+				s.state = SlotState::FREE;
+			}
+		}
+	}
+
+	size_t latest = slots.size();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < slots.size(); ++i) {
+			if (slots[i].state == SlotState::READY
+					&& (latest == slots.size() || slots[i].frame > slots[latest].frame))
+			{
+				latest = i;
+			}
+		}
+		if (latest == slots.size()) {
+			return false;
+		}
+		// Older frames which were never uploaded have been superseded
+		for (auto &s : slots) {
+			if (s.state == SlotState::READY) {
+				s.state = SlotState::FREE;
+			}
+		}
+		slots[latest].state = SlotState::IN_FLIGHT;
+		if (tag) {
+			*tag = slots[latest].tag;
+		}
+	}
+
+	tex.resize(slots[latest].width, slots[latest].height);
+	tex.upload_from_buffer(buffer, latest * slot_bytes);
+	slots[latest].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	return true;
+}
+
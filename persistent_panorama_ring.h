@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <GL/gl3w.h>
+#include "panorama_render_engine.h"
+#include "panorama_texture.h"
+
+// A ring of panorama slots in one persistently and coherently mapped
+// buffer (ARB_buffer_storage), which the render engine writes finished
+// frames into directly from its thread. The GL thread transfers the most
+// recent frame into the panorama texture straight from the buffer, and
+// fences keep a slot from being rewritten while that transfer is in flight.
+struct PersistentPanoramaRing : PanoramaSink {
+	enum class SlotState { FREE, WRITING, READY, IN_FLIGHT };
+
+	struct Slot {
+		SlotState state;
+		// Sequence number of the frame held by the slot
+		uint64_t frame;
+		// Tag of the scene the frame was rendered with
+		uint64_t tag;
+		// Size of the panorama in the slot
+		int width, height;
+		GLsync fence;
+	};
+
+	// Each slot holds a panorama of up to max_width x max_height pixels
+	PersistentPanoramaRing(int max_width, int max_height, size_t num_slots = 3);
+	~PersistentPanoramaRing();
+	PersistentPanoramaRing(const PersistentPanoramaRing&) = delete;
+	PersistentPanoramaRing& operator=(const PersistentPanoramaRing&) = delete;
+
+	// Called from the render thread
+	uint32_t* begin_write(int width, int height) override;
+	void end_write(uint64_t tag) override;
+
+	// Start the transfer of the most recent complete panorama into the
+	// texture, returns false if there's no new panorama. The texture is
+	// resized if the panorama's size has changed. The frame's tag is
+	// written to tag if it's not null. Called from the GL thread, the
+	// texture is bound to the active texture unit
+	bool upload_latest(PanoramaTexture &tex, uint64_t *tag = nullptr);
+
+	GLuint buffer;
+	uint8_t *mapping;
+	size_t slot_bytes;
+	std::vector<Slot> slots;
+	// Guards slot states and frame numbers, fences are only touched by
+	// the GL thread
+	std::mutex mutex;
+	uint64_t frame_counter;
+	size_t writing;
+};
+
@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <cmath>
+#include "resolution_governor.h"
+
+using namespace ospcommon;
+
+// Frames skipped after a resize, which include rebuilding the framebuffer
+static const int WARMUP_FRAMES = 2;
+// Frames averaged before the scale is reconsidered
+static const int SETTLE_FRAMES = 8;
+// Weight of each new frame in the moving average
+static const float AVERAGE_WEIGHT = 0.2f;
+// Relative change in scale needed to resize
+static const float RESIZE_MARGIN = 0.15f;
+
+ResolutionGovernor::ResolutionGovernor(const vec2i &base_size, float target_ms,
+		float min_scale, float max_scale)
+	: base_size(base_size), target_ms(target_ms), min_scale(min_scale),
+	max_scale(max_scale), scale(1.f), average_ms(0.f), samples(0)
+{
+	scale = std::min(std::max(scale, min_scale), max_scale);
+}
+bool ResolutionGovernor::update(float frame_ms) {
+	++samples;
+	if (samples <= WARMUP_FRAMES) {
+		return false;
+	}
+	if (samples == WARMUP_FRAMES + 1) {
+		average_ms = frame_ms;
+	} else {
+		average_ms += AVERAGE_WEIGHT * (frame_ms - average_ms);
+	}
+	if (samples < WARMUP_FRAMES + SETTLE_FRAMES || average_ms <= 0.f) {
+		return false;
+	}
+
+	const float desired = std::min(std::max(scale * std::sqrt(target_ms / average_ms),
+				min_scale), max_scale);
+	if (std::abs(desired / scale - 1.f) < RESIZE_MARGIN) {
+		return false;
+	}
+	const vec2i old_size = size();
+	scale = desired;
+	samples = 0;
+	return size() != old_size;
+}
+vec2i ResolutionGovernor::size() const {
+	return scaled_size(scale);
+}
+vec2i ResolutionGovernor::max_size() const {
+	return scaled_size(max_scale);
+}
+vec2i ResolutionGovernor::scaled_size(float s) const {
+	const int height = std::max(static_cast<int>(base_size.y * s + 0.5f), 8);
+	// Keep whole number aspect ratios exact, e.g. the six square faces of
+	// a cube map or the 2:1 equirectangular image
+	if (base_size.x % base_size.y == 0) {
+		return vec2i(height * (base_size.x / base_size.y), height);
+	}
+	return vec2i(std::max(static_cast<int>(base_size.x * s + 0.5f), 8), height);
+}
+
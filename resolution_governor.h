@@ -0,0 +1,31 @@
+#pragma once
+
+#include "ospcommon/vec.h"
+
+// Scales the panorama's resolution to keep OSPRay's frame time near a
+// target. The frame time grows with the number of pixels, so the scale
+// is adjusted by the square root of the ratio between the target and a
+// moving average of the measured time. Resizing restarts accumulation,
+// so the governor waits for the average to settle and only resizes when
+// the scale is off by more than a margin.
+struct ResolutionGovernor {
+	// The panorama is scaled from base_size, keeping its aspect ratio,
+	// between min_scale and max_scale
+	ResolutionGovernor(const ospcommon::vec2i &base_size, float target_ms,
+			float min_scale, float max_scale);
+	// Record the time taken by a full resolution frame, returns true if
+	// the panorama should be resized to size()
+	bool update(float frame_ms);
+	ospcommon::vec2i size() const;
+	// The largest size the governor may pick
+	ospcommon::vec2i max_size() const;
+	ospcommon::vec2i scaled_size(float s) const;
+
+	ospcommon::vec2i base_size;
+	float target_ms, min_scale, max_scale;
+	float scale;
+	float average_ms;
+	// Frames measured at the current scale
+	int samples;
+};
+
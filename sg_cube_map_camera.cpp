@@ -0,0 +1,27 @@
+#include "common/sg/camera/Camera.h"
+
+namespace ospray {
+	namespace sg {
+
+		// Scene graph node for the module's cubemap camera, taking the same
+		// children as the PanoramicCamera node so they can be swapped freely
+		struct CubeMapCamera : public Camera {
+			CubeMapCamera() : Camera("cubemap") {
+				createChild("pos", "vec3f", vec3f(0, -1, 0));
+				createChild("dir", "vec3f", vec3f(0, 0, 1), NodeFlags::required);
+				createChild("up", "vec3f", vec3f(0, 0, 1), NodeFlags::required);
+				createChild("equiAngular", "bool", false);
+			}
+			std::string toString() const override {
+				return "ospray::sg::CubeMapCamera";
+			}
+			void postCommit(RenderContext &) override {
+				ospCommit(valueAs<OSPCamera>());
+			}
+		};
+
+		OSP_REGISTER_SG_NODE(CubeMapCamera);
+
+	}
+}
+
@@ -0,0 +1,28 @@
+#include "common/sg/camera/Camera.h"
+
+namespace ospray {
+	namespace sg {
+
+		// Scene graph node for the module's foveated camera, taking the same
+		// children as the PanoramicCamera node plus the gaze to foveate on
+		struct FoveatedCamera : public Camera {
+			FoveatedCamera() : Camera("foveated") {
+				createChild("pos", "vec3f", vec3f(0, -1, 0));
+				createChild("dir", "vec3f", vec3f(0, 0, 1), NodeFlags::required);
+				createChild("up", "vec3f", vec3f(0, 0, 1), NodeFlags::required);
+				createChild("gazeDir", "vec3f", vec3f(0, 0, -1));
+				createChild("foveation", "float", 2.18f);
+			}
+			std::string toString() const override {
+				return "ospray::sg::FoveatedCamera";
+			}
+			void postCommit(RenderContext &) override {
+				ospCommit(valueAs<OSPCamera>());
+			}
+		};
+
+		OSP_REGISTER_SG_NODE(FoveatedCamera);
+
+	}
+}
+
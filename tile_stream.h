@@ -0,0 +1,23 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "bounded_queue.h"
+
+// The largest tile which can be streamed, matching OSPRay's default TILE_SIZE
+const int STREAMED_TILE_SIZE = 64;
+
+// A finished tile of the panorama, pushed by the tile_stream pixel op from
+// OSPRay's render threads as soon as it's accumulated
+struct StreamedTile {
+	// Region of the panorama covered by the tile
+	int x, y, width, height;
+	// Size of the panorama the tile belongs to, which changes when the
+	// panorama is resized
+	int frame_width, frame_height;
+	// RGBA8 pixels, rows are STREAMED_TILE_SIZE pixels apart
+	std::array<uint32_t, STREAMED_TILE_SIZE * STREAMED_TILE_SIZE> pixels;
+};
+
+using TileQueue = BoundedQueue<StreamedTile>;
+
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cmath>
+#include "ospray/fb/FrameBuffer.h"
+#include "ospray/fb/PixelOp.h"
+#include "ospray/fb/Tile.h"
+#include "tile_stream.h"
+
+namespace ospray {
+
+	static_assert(TILE_SIZE <= STREAMED_TILE_SIZE,
+			"OSPRay's TILE_SIZE is larger than the streamed tiles");
+
+	// Pushes each tile to a TileQueue as soon as it's been accumulated, so
+	// the display can show finished regions of the panorama before the rest
+	// of the frame is done. The queue is passed as the "queue" void pointer
+	// parameter, and "srgb" selects whether tiles are converted to sRGB to
+	// match an OSP_FB_SRGBA framebuffer (the default) or stored linearly.
+	struct TileStreamPixelOp : public PixelOp {
+		struct Instance : public PixelOp::Instance {
+			Instance(FrameBuffer *fb, PixelOp::Instance *prev, TileQueue *queue,
+					const std::array<uint8_t, 4096> &to_byte)
+				: prev(prev), queue(queue), to_byte(to_byte)
+			{
+				this->fb = fb;
+			}
+			void beginFrame() override {
+				if (prev) {
+					prev->beginFrame();
+				}
+			}
+			void endFrame() override {
+				if (prev) {
+					prev->endFrame();
+				}
+			}
+			void preAccum(Tile &tile) override {
+				if (prev) {
+					prev->preAccum(tile);
+				}
+			}
+			void postAccum(Tile &tile) override {
+				if (prev) {
+					prev->postAccum(tile);
+				}
+				const int width = tile.region.upper.x - tile.region.lower.x;
+				const int height = tile.region.upper.y - tile.region.lower.y;
+				// If the display has fallen behind we drop the tile rather than
+				// stall a render thread, it'll be sent again with the next frame
+				queue->push([&](StreamedTile &out) {
+					out.x = tile.region.lower.x;
+					out.y = tile.region.lower.y;
+					out.width = width;
+					out.height = height;
+					out.frame_width = fb->size.x;
+					out.frame_height = fb->size.y;
+					for (int y = 0; y < height; ++y) {
+						for (int x = 0; x < width; ++x) {
+							const int i = y * TILE_SIZE + x;
+							out.pixels[y * STREAMED_TILE_SIZE + x] = to_rgba8(tile.r[i], tile.g[i],
+									tile.b[i], tile.a[i]);
+						}
+					}
+				});
+			}
+			std::string toString() const override {
+				return "ospray::TileStreamPixelOp::Instance";
+			}
+
+			uint32_t to_rgba8(float r, float g, float b, float a) const {
+				const auto quantize = [](float v) {
+					return static_cast<uint32_t>(std::min(std::max(v, 0.f), 1.f) * 4095.f);
+				};
+				return uint32_t(to_byte[quantize(r)])
+					| uint32_t(to_byte[quantize(g)]) << 8
+					| uint32_t(to_byte[quantize(b)]) << 16
+					| static_cast<uint32_t>(std::min(std::max(a, 0.f), 1.f) * 255.f) << 24;
+			}
+
+			Ref<PixelOp::Instance> prev;
+			TileQueue *queue;
+			const std::array<uint8_t, 4096> to_byte;
+		};
+
+		void commit() override {
+			queue = static_cast<TileQueue*>(getParamVoidPtr("queue", nullptr));
+			const bool srgb = getParam1i("srgb", 1);
+			for (size_t i = 0; i < to_byte.size(); ++i) {
+				float v = i / float(to_byte.size() - 1);
+				if (srgb) {
+					v = v <= 0.0031308f ? 12.92f * v : 1.055f * std::pow(v, 1.f / 2.4f) - 0.055f;
+				}
+				to_byte[i] = static_cast<uint8_t>(v * 255.f + 0.5f);
+			}
+		}
+		PixelOp::Instance* createInstance(FrameBuffer *fb, PixelOp::Instance *prev) override {
+			if (!queue) {
+				throw std::runtime_error("tile_stream pixel op requires a queue");
+			}
+			return new Instance(fb, prev, queue, to_byte);
+		}
+		std::string toString() const override {
+			return "ospray::TileStreamPixelOp";
+		}
+
+		TileQueue *queue = nullptr;
+		// Lookup table quantizing [0, 1] color values to bytes
+		std::array<uint8_t, 4096> to_byte;
+	};
+
+	OSP_REGISTER_PIXEL_OP(TileStreamPixelOp, tile_stream);
+
+}
+
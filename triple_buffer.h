@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// A wait-free triple buffer handing the latest item from one producer to
+// one consumer. The producer always has a back buffer to write to and the
+// consumer always gets the latest published one, which neither side ever
+// waits on: publishing swaps the back buffer with the ready one, and
+// taking the ready one swaps it with the front buffer, through a single
+// atomic exchange each. Items the consumer doesn't take in time are
+// replaced by newer ones.
+template<typename T>
+struct TripleBuffer {
+	TripleBuffer() : back(0), front(2), ready(1) {}
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	// The buffer the producer writes the next item into
+	T& back_buffer() {
+		return slots[back];
+	}
+	// Publish the back buffer and get a new one to write to. Returns true
+	// if the item it replaces was never taken by the consumer
+	bool publish() {
+		const uint32_t prev = ready.exchange(back | NEW_ITEM, std::memory_order_acq_rel);
+		back = prev & ~NEW_ITEM;
+		return (prev & NEW_ITEM) != 0;
+	}
+	// Check if an item newer than the front buffer has been published
+	bool has_new() const {
+		return (ready.load(std::memory_order_acquire) & NEW_ITEM) != 0;
+	}
+	// Take the latest item into the front buffer, returns false and leaves
+	// the front buffer as is if there's nothing newer
+	bool acquire() {
+		if (!has_new()) {
+			return false;
+		}
+		front = ready.exchange(front, std::memory_order_acq_rel) & ~NEW_ITEM;
+		return true;
+	}
+	// The buffer the consumer reads, until it next acquires
+	T& front_buffer() {
+		return slots[front];
+	}
+	const T& front_buffer() const {
+		return slots[front];
+	}
+
+	// Set in ready while the item in it hasn't been taken
+	static const uint32_t NEW_ITEM = 4;
+
+	std::array<T, 3> slots;
+	// Only touched by the producer and consumer respectively, kept on
+	// separate cache lines from each other and the shared index
+	uint32_t back;
+	char pad0[64];
+	uint32_t front;
+	char pad1[64];
+	std::atomic<uint32_t> ready;
+};
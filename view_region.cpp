@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cmath>
+#include "view_region.h"
+
+static const float PI = 3.14159265358979323846f;
+
+PanoramaProjection::PanoramaProjection(PanoramaLayout layout, int width, int height)
+	: layout(layout), width(width), height(height), equi_angular(false),
+	foveated(false), gaze_frame(1.f), foveation(1.f)
+{}
+glm::vec2 PanoramaProjection::project(const glm::vec3 &d) const {
+	const glm::vec3 dir = glm::normalize(d);
+	float u = 0.f;
+	float v = 0.f;
+	if (layout == PanoramaLayout::CUBE_MAP) {
+		// Pick the face and its coordinates following the GL spec's cube
+		// map table, as the cubemap camera lays them out
+		const glm::vec3 a(std::abs(dir.x), std::abs(dir.y), std::abs(dir.z));
+		int face = 0;
+		float sc = 0.f, tc = 0.f, ma = 0.f;
+		if (a.x >= a.y && a.x >= a.z) {
+			face = dir.x > 0 ? 0 : 1;
+			sc = dir.x > 0 ? -dir.z : dir.z;
+			tc = -dir.y;
+			ma = a.x;
+		} else if (a.y >= a.z) {
+			face = dir.y > 0 ? 2 : 3;
+			sc = dir.x;
+			tc = dir.y > 0 ? dir.z : -dir.z;
+			ma = a.y;
+		} else {
+			face = dir.z > 0 ? 4 : 5;
+			sc = dir.z > 0 ? dir.x : -dir.x;
+			tc = -dir.y;
+			ma = a.z;
+		}
+		sc /= ma;
+		tc /= ma;
+		if (equi_angular) {
+			sc = std::atan(sc) * 4.f / PI;
+			tc = std::atan(tc) * 4.f / PI;
+		}
+		u = (face + (sc + 1.f) * 0.5f) / 6.f;
+		v = (tc + 1.f) * 0.5f;
+	} else if (foveated) {
+		const glm::vec3 l = glm::transpose(gaze_frame) * dir;
+		const float az = std::atan2(l.x, l.z) / PI;
+		const float el = std::asin(std::min(std::max(l.y, -1.f), 1.f)) / (PI / 2.f);
+		u = std::asinh(az * std::sinh(foveation)) / foveation * 0.5f + 0.5f;
+		v = std::asinh(el * std::sinh(foveation)) / foveation * 0.5f + 0.5f;
+	} else {
+		u = (std::atan2(dir.z, dir.x) + PI / 2.f) / (2.f * PI);
+		if (u < 0.f) {
+			u += 1.f;
+		}
+		v = std::acos(std::min(std::max(dir.y, -1.f), 1.f)) / PI;
+	}
+	return glm::vec2(std::min(std::max(u * width, 0.f), width - 1.f),
+			std::min(std::max(v * height, 0.f), height - 1.f));
+}
+bool PanoramaProjection::wraps() const {
+	return layout == PanoramaLayout::EQUIRECT;
+}
+std::vector<glm::vec3> PanoramaProjection::poles() const {
+	std::vector<glm::vec3> p;
+	if (layout == PanoramaLayout::EQUIRECT) {
+		const glm::vec3 up = foveated ? gaze_frame[1] : glm::vec3(0, 1, 0);
+		p.push_back(up);
+		p.push_back(-up);
+	}
+	return p;
+}
+
+namespace {
+	struct Bounds {
+		glm::vec2 lo, hi;
+		bool empty;
+
+		Bounds() : lo(0.f), hi(0.f), empty(true) {}
+		void extend(const glm::vec2 &p) {
+			if (empty) {
+				lo = hi = p;
+				empty = false;
+			} else {
+				lo = glm::vec2(std::min(lo.x, p.x), std::min(lo.y, p.y));
+				hi = glm::vec2(std::max(hi.x, p.x), std::max(hi.y, p.y));
+			}
+		}
+	};
+
+	// Snap the pixel range [lo, hi] out to tiles, grow it by the margin
+	// and clamp it to the chart [x_min, x_max) x [0, height)
+	TileRect snap_region(glm::vec2 lo, glm::vec2 hi, int tile_size, int margin,
+			int x_min, int x_max, int height)
+	{
+		const int x0 = std::max((static_cast<int>(lo.x) / tile_size - margin) * tile_size, x_min);
+		const int y0 = std::max((static_cast<int>(lo.y) / tile_size - margin) * tile_size, 0);
+		const int x1 = std::min((static_cast<int>(hi.x) / tile_size + 1 + margin) * tile_size, x_max);
+		const int y1 = std::min((static_cast<int>(hi.y) / tile_size + 1 + margin) * tile_size, height);
+		return TileRect{x0, y0, x1 - x0, y1 - y0};
+	}
+}
+
+void find_view_regions(const PanoramaProjection &projection,
+		const std::vector<glm::mat4> &proj_views, int tile_size, int margin,
+		std::vector<TileRect> &regions)
+{
+	// Samples across each view's far plane, enough that the curved edges of
+	// the view in the panorama don't bulge much past them between samples
+	const int SAMPLES = 16;
+	const bool cube_map = projection.layout == PanoramaLayout::CUBE_MAP;
+	const int face_width = cube_map ? projection.width / 6 : projection.width;
+	std::vector<Bounds> charts(cube_map ? 6 : 1);
+	std::vector<float> xs;
+
+	for (const auto &pv : proj_views) {
+		const glm::mat4 inv = glm::inverse(pv);
+		for (int j = 0; j < SAMPLES; ++j) {
+			for (int i = 0; i < SAMPLES; ++i) {
+				const glm::vec4 p = inv * glm::vec4(2.f * i / (SAMPLES - 1) - 1.f,
+						2.f * j / (SAMPLES - 1) - 1.f, 1.f, 1.f);
+				const glm::vec2 px = projection.project(glm::vec3(p.x, p.y, p.z) / p.w);
+				const int chart = cube_map ? std::min(static_cast<int>(px.x) / face_width, 5) : 0;
+				charts[chart].extend(px);
+				xs.push_back(px.x);
+			}
+		}
+	}
+
+	regions.clear();
+	if (!projection.wraps()) {
+		for (size_t i = 0; i < charts.size(); ++i) {
+			if (!charts[i].empty) {
+				regions.push_back(snap_region(charts[i].lo, charts[i].hi, tile_size, margin,
+							i * face_width, (i + 1) * face_width, projection.height));
+			}
+		}
+		return;
+	}
+
+	// A pole in view means every column of the panorama is seen around it
+	Bounds &bounds = charts[0];
+	bool full_width = false;
+	for (const auto &pole : projection.poles()) {
+		for (const auto &pv : proj_views) {
+			const glm::vec4 c = pv * glm::vec4(pole, 0.f);
+			if (c.w > 0.f && std::abs(c.x) <= c.w && std::abs(c.y) <= c.w) {
+				bounds.extend(projection.project(pole));
+				full_width = true;
+			}
+		}
+	}
+	const int width = projection.width;
+	if (full_width) {
+		regions.push_back(snap_region(glm::vec2(0.f, bounds.lo.y), glm::vec2(width - 1.f, bounds.hi.y),
+					tile_size, margin, 0, width, projection.height));
+		return;
+	}
+
+	// The columns seen are the complement of the largest gap between the
+	// sampled columns, which may be the gap across the wrapped edge
+	std::sort(xs.begin(), xs.end());
+	size_t gap = xs.size() - 1;
+	float gap_size = xs.front() + width - xs.back();
+	for (size_t i = 0; i + 1 < xs.size(); ++i) {
+		if (xs[i + 1] - xs[i] > gap_size) {
+			gap = i;
+			gap_size = xs[i + 1] - xs[i];
+		}
+	}
+	if (gap == xs.size() - 1) {
+		regions.push_back(snap_region(bounds.lo, bounds.hi, tile_size, margin,
+					0, width, projection.height));
+	} else {
+		regions.push_back(snap_region(glm::vec2(xs[gap + 1], bounds.lo.y),
+					glm::vec2(width - 1.f, bounds.hi.y), tile_size, margin, 0, width, projection.height));
+		regions.push_back(snap_region(glm::vec2(0.f, bounds.lo.y),
+					glm::vec2(xs[gap], bounds.hi.y), tile_size, margin, 0, width, projection.height));
+	}
+}
+bool regions_contain(const std::vector<TileRect> &outer, const std::vector<TileRect> &inner) {
+	for (const auto &r : inner) {
+		const bool contained = std::any_of(outer.begin(), outer.end(),
+			[&](const TileRect &o) {
+				return r.x >= o.x && r.y >= o.y && r.x + r.width <= o.x + o.width
+					&& r.y + r.height <= o.y + o.height;
+			});
+		if (!contained) {
+			return false;
+		}
+	}
+	return true;
+}
+
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "dirty_tiles.h"
+#include "panorama_texture.h"
+
+// Maps directions in the display's frame to pixels in the panorama being
+// rendered, the same way the display shaders look them up
+struct PanoramaProjection {
+	PanoramaLayout layout;
+	int width, height;
+	bool equi_angular;
+	// Set for panoramas from the foveated camera, along with the gaze frame
+	// and strength they were rendered with
+	bool foveated;
+	glm::mat3 gaze_frame;
+	float foveation;
+
+	PanoramaProjection(PanoramaLayout layout, int width, int height);
+	// Get the pixel the direction falls in, x is in [0, width) and y in
+	// [0, height)
+	glm::vec2 project(const glm::vec3 &dir) const;
+	// Check if the panorama's x axis wraps around, so regions can cross
+	// its left and right edges
+	bool wraps() const;
+	// Directions which map to a whole row of the panorama, and so pull any
+	// region seeing them out to its full width. Empty for cube maps
+	std::vector<glm::vec3> poles() const;
+};
+
+// Find the regions of the panorama seen through the view-projection
+// matrices, which must have their translation removed. Regions are grown
+// by margin tiles and snapped out to tile_size, a region crossing the
+// panorama's wrapped edge is split in two, and cube maps get a region
+// per visible face.
+void find_view_regions(const PanoramaProjection &projection,
+		const std::vector<glm::mat4> &proj_views, int tile_size, int margin,
+		std::vector<TileRect> &regions);
+
+// Check if each of the inner regions is contained in one of the outer ones
+bool regions_contain(const std::vector<TileRect> &outer, const std::vector<TileRect> &inner);
+
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <GL/gl3w.h>
+#include "frame_timing.h"
+#include "hidden_area_mask.h"
+
+// The headset an OpenVRDisplay renders for. OpenVRBackend drives a real
+// HMD through OpenVR, while MockVRBackend stands in for one so the VR path
+// can be run and measured without a headset.
+struct VRBackend {
+	virtual ~VRBackend() {}
+	// The recommended width and height of each eye's render target
+	virtual std::array<uint32_t, 2> render_target_size() = 0;
+	virtual glm::mat4 projection(size_t eye, float near_plane, float far_plane) = 0;
+	// The eye's transform to the head's space
+	virtual glm::mat4 eye_to_head(size_t eye) = 0;
+	virtual HiddenAreaMesh hidden_area_mesh(size_t eye) = 0;
+	// The time between the display's vsyncs, in seconds
+	virtual float vsync_period() = 0;
+	// Block until it's time to render the next frame, and get the HMD's
+	// transform to absolute tracking space to render it with
+	virtual glm::mat4 wait_get_poses() = 0;
+	// Predict the HMD's transform again for when the frame being rendered
+	// reaches the display, called as late as possible before drawing
+	virtual glm::mat4 predict_pose() = 0;
+	// Submit an eye's image. It's the region of the texture given by
+	// bounds as (u min, v min, u max, v max), or with array_texture set
+	// the layer of the texture matching the eye. The pose is the HMD
+	// transform the eye was rendered with
+	virtual void submit(size_t eye, GLuint texture, bool array_texture,
+			const glm::vec4 &bounds, const glm::mat4 &pose) = 0;
+	// Get the timing of the most recent frame the compositor finished
+	// with, returns false if there isn't one yet
+	virtual bool frame_timing(FrameTiming &timing) = 0;
+};
+